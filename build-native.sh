@@ -0,0 +1,48 @@
+#!/bin/bash
+
+# Build script for native (non-browser) builds of the pipes engines
+
+CC=${CC:-cc}
+CFLAGS="-O3 -march=native -flto -Wall"
+
+# PIPES_TRACE=1 ./build-native.sh builds in the trace markers (src/trace.h);
+# run the programs with -trace file.json to record a timeline
+if [ -n "$PIPES_TRACE" ]; then
+    CFLAGS="$CFLAGS -DPIPES_TRACE"
+fi
+
+mkdir -p build/native
+
+echo "Building software engine benchmark..."
+$CC $CFLAGS src/pipes.c src/trace.c native/bench.c -o build/native/pipes_bench -lm -lpthread
+
+echo "Building X11 screensaver..."
+$CC $CFLAGS src/pipes.c src/trace.c native/x11_host.c -o build/native/pipes_x11 -lX11 -lm -lpthread
+
+echo "Building frame exporter..."
+$CC $CFLAGS src/pipes.c src/trace.c native/export.c -o build/native/pipes_export -lm -lpthread
+
+echo "Building shared-memory host and viewer..."
+$CC $CFLAGS src/pipes.c src/trace.c native/shm_host.c -o build/native/pipes_shm -lm -lpthread -lrt
+$CC $CFLAGS native/shm_view.c -o build/native/pipes_shm_view -lrt
+
+# The raylib engines need a desktop build of raylib
+if pkg-config --exists raylib; then
+    echo "Building raylib desktop version..."
+    $CC $CFLAGS src/pipes_3d.c src/pipes_2d_raylib.c src/trace.c native/raylib_host.c \
+        -o build/native/pipes_raylib \
+        $(pkg-config --cflags --libs raylib) -lm
+
+    echo "Building 3D frame exporter..."
+    $CC $CFLAGS -DEXPORT_3D src/pipes_3d.c src/trace.c native/export.c \
+        -o build/native/pipes_export_3d \
+        $(pkg-config --cflags --libs raylib) -lm -lpthread
+else
+    echo "raylib not found via pkg-config, skipping build/native/pipes_raylib"
+fi
+
+echo "Build complete!"
+echo "Benchmark: build/native/pipes_bench [-threads n] [-pipes n]"
+echo "X11 screensaver: build/native/pipes_x11 [-root | -window-id <id>] [-record path | -replay path]"
+echo "Frame exporter: build/native/pipes_export [-w width] [-h height] [-n frames] [-format y4m|rgba] [-o file|-]"
+echo "Shared memory: build/native/pipes_shm [-name /pipes] [-buffers n] [-w width] [-h height], read with build/native/pipes_shm_view [-name /pipes] [-o last.ppm]"
@@ -17,29 +17,43 @@ if [ ! -f "lib/libraylib_web.a" ]; then
     cd ..
 fi
 
-# Common Emscripten flags
-COMMON_FLAGS="-O3 -s USE_GLFW=3 -s ASYNCIFY -s TOTAL_MEMORY=67108864 -s FORCE_FILESYSTEM=1 -DPLATFORM_WEB -s MODULARIZE=1 -s EXPORT_ES6=1 -s EXPORT_NAME='createModule'"
-
-# Build 2D Raylib version
-echo "Building 2D Raylib version..."
-emcc src/pipes_2d_raylib.c \
-    -o src/wasm/pipes_2d_raylib.js \
-    -I lib/raylib-5.0_webassembly/include \
-    lib/libraylib_web.a \
-    $COMMON_FLAGS \
-    -s EXPORTED_RUNTIME_METHODS="['ccall','cwrap']" \
-    -s EXPORTED_FUNCTIONS="['_malloc','_free','_pipes2d_init','_pipes2d_frame','_pipes2d_setSpeed','_pipes2d_setThickness','_pipes2d_setPipeCount','_pipes2d_resize','_pipes2d_cleanup']"
-
-# Build 3D Raylib version
-echo "Building 3D Raylib version..."
-emcc src/pipes_3d.c \
-    -o src/wasm/pipes_3d_raylib.js \
-    -I lib/raylib-5.0_webassembly/include \
-    lib/libraylib_web.a \
-    $COMMON_FLAGS \
-    -s EXPORTED_RUNTIME_METHODS="['ccall','cwrap']" \
-    -s EXPORTED_FUNCTIONS="['_malloc','_free','_pipes3d_init','_pipes3d_frame','_pipes3d_setFadeSpeed','_pipes3d_setSpawnRate','_pipes3d_setTurnProbability','_pipes3d_setMaxPipes','_pipes3d_setCameraSpeed','_pipes3d_setPipeSpeed','_pipes3d_setSegmentDelay','_pipes3d_mouseDown','_pipes3d_mouseUp','_pipes3d_mouseMove','_pipes3d_resize','_pipes3d_cleanup']"
+# Common Emscripten flags. No ASYNCIFY: the engines never block, the page
+# drives them through exported per-frame functions. The heap starts at 64 MB
+# and may grow, so very large canvases no longer run out of memory.
+COMMON_FLAGS="-O3 -s USE_GLFW=3 -s INITIAL_MEMORY=67108864 -s ALLOW_MEMORY_GROWTH=1 -s FORCE_FILESYSTEM=1 -DPLATFORM_WEB -s MODULARIZE=1 -s EXPORT_ES6=1 -s EXPORT_NAME='createModule'"
+
+# Each engine is built as baseline and WebAssembly SIMD (.simd) variants;
+# Screensaver.svelte loads the SIMD one when the browser supports it. The
+# prebuilt raylib library has no atomics, so there is no threaded variant.
+for variant in "" ".simd"; do
+    case "$variant" in
+        ".simd") VARIANT_FLAGS="-msimd128" ;;
+        *) VARIANT_FLAGS="" ;;
+    esac
+
+    # Build 2D Raylib version
+    echo "Building 2D Raylib version..."
+    emcc src/pipes_2d_raylib.c \
+        -o src/wasm/pipes_2d_raylib$variant.js \
+        -I lib/raylib-5.0_webassembly/include \
+        lib/libraylib_web.a \
+        $COMMON_FLAGS \
+        $VARIANT_FLAGS \
+        -s EXPORTED_RUNTIME_METHODS="['ccall','cwrap','HEAPU8']" \
+        -s EXPORTED_FUNCTIONS="['_malloc','_free','_pipes2d_init','_pipes2d_frame','_pipes2d_setSpeed','_pipes2d_setThickness','_pipes2d_setPipeCount','_pipes2d_setCellSize','_pipes2d_setStepsPerFrame','_pipes2d_resize','_pipes2d_cleanup','_pipes2d_replayFrame','_pipes2d_setEventRecording','_pipes2d_getEvents','_pipes2d_getEventSize','_pipes2d_clearEvents']"
+
+    # Build 3D Raylib version
+    echo "Building 3D Raylib version..."
+    emcc src/pipes_3d.c \
+        -o src/wasm/pipes_3d_raylib$variant.js \
+        -I lib/raylib-5.0_webassembly/include \
+        lib/libraylib_web.a \
+        $COMMON_FLAGS \
+        $VARIANT_FLAGS \
+        -s EXPORTED_RUNTIME_METHODS="['ccall','cwrap','HEAPU8']" \
+        -s EXPORTED_FUNCTIONS="['_malloc','_free','_pipes3d_init','_pipes3d_frame','_pipes3d_setFadeSpeed','_pipes3d_setSpawnRate','_pipes3d_setTurnProbability','_pipes3d_setMaxPipes','_pipes3d_setCameraSpeed','_pipes3d_setPipeSpeed','_pipes3d_setSegmentDelay','_pipes3d_setStepsPerFrame','_pipes3d_setRenderScale','_pipes3d_setAutoRenderScale','_pipes3d_mouseDown','_pipes3d_mouseUp','_pipes3d_mouseMove','_pipes3d_resize','_pipes3d_cleanup','_pipes3d_getCommandRing','_pipes3d_snapshotMaxSize','_pipes3d_snapshot','_pipes3d_restore','_pipes3d_replayFrame','_pipes3d_setEventRecording','_pipes3d_getEvents','_pipes3d_getEventSize','_pipes3d_clearEvents','_pipes3d_getFrameState']"
+done
 
 echo "Build complete!"
-echo "2D Raylib module: src/wasm/pipes_2d_raylib.js"
-echo "3D Raylib module: src/wasm/pipes_3d_raylib.js"
\ No newline at end of file
+echo "2D Raylib modules: src/wasm/pipes_2d_raylib{,.simd}.js"
+echo "3D Raylib modules: src/wasm/pipes_3d_raylib{,.simd}.js"
\ No newline at end of file
@@ -10,18 +10,34 @@ fi
 # Create wasm output directory
 mkdir -p src/wasm
 
+# Each engine is built in several variants and Screensaver.svelte loads the
+# best one the browser supports:
+#   <name>.js          baseline WebAssembly
+#   <name>.simd.js     WebAssembly SIMD (-msimd128)
+# There is no threaded variant: phased stepping (pipes_set_worker_threads)
+# only spreads over threads in native builds, so a -pthread build would need
+# a cross-origin isolated page and shared memory for nothing.
+
 echo "Building 2D pipes..."
 # Compile 2D pipes
-emcc src/pipes.c \
-  -o src/wasm/pipes.js \
-  -s EXPORTED_FUNCTIONS='["_init_pipes", "_update_pipes", "_get_framebuffer", "_cleanup_pipes", "_malloc", "_free", "_set_fade_speed", "_set_spawn_rate", "_set_turn_probability", "_set_max_pipes", "_set_animation_speed"]' \
-  -s EXPORTED_RUNTIME_METHODS='["ccall", "cwrap", "HEAP8", "HEAPU8", "HEAP16", "HEAPU16", "HEAP32", "HEAPU32", "HEAPF32", "HEAPF64"]' \
-  -s MODULARIZE=1 \
-  -s EXPORT_NAME='createPipesModule' \
-  -s EXPORT_ES6=1 \
-  -s ALLOW_MEMORY_GROWTH=1 \
-  -s WASM=1 \
-  -O2
+for variant in "" ".simd"; do
+  case "$variant" in
+    ".simd") VARIANT_FLAGS="-msimd128" ;;
+    *) VARIANT_FLAGS="" ;;
+  esac
+
+  emcc src/pipes.c \
+    -o src/wasm/pipes$variant.js \
+    -s EXPORTED_FUNCTIONS='["_pipes_create", "_pipes_destroy", "_pipes_init", "_pipes_update", "_pipes_get_framebuffer", "_pipes_cleanup", "_pipes_set_fade_speed", "_pipes_set_spawn_rate", "_pipes_set_turn_probability", "_pipes_set_max_pipes", "_pipes_set_animation_speed", "_pipes_set_pipe_capacity", "_pipes_set_steps_per_frame", "_pipes_set_worker_threads", "_pipes_set_present_mode", "_pipes_get_frame_fade", "_pipes_get_frame_state", "_pipes_get_dirty_tile_count", "_pipes_get_dirty_tiles", "_pipes_get_width", "_pipes_get_height", "_pipes_set_event_recording", "_pipes_get_events", "_pipes_get_event_size", "_pipes_clear_events", "_pipes_replay", "_pipes_get_command_ring", "_pipes_get_memory_usage", "_pipes_get_memory_required", "_pipes_reserve_memory", "_pipes_snapshot_max_size", "_pipes_snapshot", "_pipes_set_snapshot_image", "_pipes_restore", "_malloc", "_free"]' \
+    -s EXPORTED_RUNTIME_METHODS='["ccall", "cwrap", "HEAP8", "HEAPU8", "HEAP16", "HEAPU16", "HEAP32", "HEAPU32", "HEAPF32", "HEAPF64"]' \
+    -s MODULARIZE=1 \
+    -s EXPORT_NAME='createPipesModule' \
+    -s EXPORT_ES6=1 \
+    -s ALLOW_MEMORY_GROWTH=1 \
+    -s WASM=1 \
+    $VARIANT_FLAGS \
+    -O2
+done
 
 echo "2D build complete!"
 
@@ -37,22 +53,32 @@ if [ ! -f "lib/libraylib_web.a" ]; then
 fi
 
 echo "Building 3D pipes..."
-# Compile 3D pipes with Raylib
-emcc src/pipes_3d.c \
-  -o src/wasm/pipes_3d.js \
-  -I lib/raylib-5.0_webassembly/include \
-  lib/libraylib_web.a \
-  -s EXPORTED_FUNCTIONS='["_init_3d_pipes", "_update_3d_pipes", "_get_3d_framebuffer", "_cleanup_3d_pipes", "_set_3d_fade_speed", "_set_3d_spawn_rate", "_set_3d_turn_probability", "_set_3d_max_pipes", "_handle_mouse_down", "_handle_mouse_up", "_handle_mouse_move", "_malloc", "_free"]' \
-  -s EXPORTED_RUNTIME_METHODS='["ccall", "cwrap", "HEAP8", "HEAPU8", "HEAP16", "HEAPU16", "HEAP32", "HEAPU32", "HEAPF32", "HEAPF64"]' \
-  -s USE_GLFW=3 \
-  -s ASYNCIFY \
-  -s MODULARIZE=1 \
-  -s EXPORT_NAME='createPipes3DModule' \
-  -s EXPORT_ES6=1 \
-  -s ALLOW_MEMORY_GROWTH=1 \
-  -s WASM=1 \
-  -s TOTAL_MEMORY=67108864 \
-  -O2
+# Compile 3D pipes with Raylib. The prebuilt raylib library is not compiled
+# with atomics, so it cannot be linked into a threaded module. The engine is
+# driven per frame from requestAnimationFrame and never blocks, so it is
+# linked without ASYNCIFY.
+for variant in "" ".simd"; do
+  case "$variant" in
+    ".simd") VARIANT_FLAGS="-msimd128" ;;
+    *) VARIANT_FLAGS="" ;;
+  esac
+
+  emcc src/pipes_3d.c \
+    -o src/wasm/pipes_3d$variant.js \
+    -I lib/raylib-5.0_webassembly/include \
+    lib/libraylib_web.a \
+    -s EXPORTED_FUNCTIONS='["_pipes3d_init", "_pipes3d_frame", "_pipes3d_resize", "_pipes3d_cleanup", "_pipes3d_getCommandRing", "_pipes3d_snapshotMaxSize", "_pipes3d_snapshot", "_pipes3d_restore", "_pipes3d_setEventRecording", "_pipes3d_getEvents", "_pipes3d_getEventSize", "_pipes3d_clearEvents", "_pipes3d_replayFrame", "_pipes3d_getFrameState", "_malloc", "_free"]' \
+    -s EXPORTED_RUNTIME_METHODS='["ccall", "cwrap", "HEAP8", "HEAPU8", "HEAP16", "HEAPU16", "HEAP32", "HEAPU32", "HEAPF32", "HEAPF64"]' \
+    -s USE_GLFW=3 \
+    -s MODULARIZE=1 \
+    -s EXPORT_NAME='createPipes3DModule' \
+    -s EXPORT_ES6=1 \
+    -s ALLOW_MEMORY_GROWTH=1 \
+    -s WASM=1 \
+    -s TOTAL_MEMORY=67108864 \
+    $VARIANT_FLAGS \
+    -O2
+done
 
 echo "3D build complete!"
-echo "All WASM builds complete!"
\ No newline at end of file
+echo "All WASM builds complete!"
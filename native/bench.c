@@ -0,0 +1,178 @@
+// Native throughput benchmark for the software engine (src/pipes.c).
+// Runs the engine at several steps-per-frame multipliers and reports frames
+// and simulation steps per second for each. -threads switches to phased
+// stepping on that many threads, -pipes sets how many pipes run at once.
+//
+// -counters adds hardware counters (src/perf_counters.h) to every run: IPC
+// and L1D, LLC and branch misses per pixel for whole frames and the fade,
+// per call for the rest. Builds with PIPES_TRACE break this down by traced
+// phase across all threads, others count whole frames on the main thread.
+// Where the counters are unavailable, as in most containers, the benchmark
+// says so and reports time alone.
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../src/perf_counters.h"
+#include "../src/pipes.h"
+#include "../src/trace.h"
+
+#define MAX_PHASES 64
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr, "usage: %s [-w width] [-h height] [-t seconds per run] [-threads n] [-pipes n] [-counters]\n"
+                    "          [-trace file.json]\n", prog);
+}
+
+// Ratio for one cell, "-" without the counters behind it
+static void print_ratio(unsigned int available, int counter, int by, double value, double units) {
+    int have = (available >> counter) & 1 && (by < 0 || ((available >> by) & 1));
+    if (!have || units <= 0) {
+        printf(" %11s", "-");
+    } else {
+        printf(" %11.4f", value / units);
+    }
+}
+
+static int by_time(const void* a, const void* b) {
+    uint64_t x = ((const TracePhase*)a)->ns, y = ((const TracePhase*)b)->ns;
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+// Phases that touch every pixel are per pixel, the others per call: one
+// pipe step for update_pipe, one segment or elbow for the rasterizers
+static void print_phase(const TracePhase* phase, unsigned int available, double pixels) {
+    int per_pixel = strcmp(phase->name, "frame") == 0 || strcmp(phase->name, "fade") == 0 ||
+                    strcmp(phase->name, "clear tiles") == 0;
+    double units = per_pixel ? pixels * phase->calls : (double)phase->calls;
+    printf("  %-19s %10llu %11.0f", phase->name, (unsigned long long)phase->calls,
+           phase->calls ? (double)phase->ns / phase->calls : 0.0);
+    print_ratio(available, PERF_INSTRUCTIONS, PERF_CYCLES, (double)phase->counters[PERF_INSTRUCTIONS],
+                (double)phase->counters[PERF_CYCLES]);
+    print_ratio(available, PERF_L1D_MISSES, -1, (double)phase->counters[PERF_L1D_MISSES], units);
+    print_ratio(available, PERF_LLC_MISSES, -1, (double)phase->counters[PERF_LLC_MISSES], units);
+    print_ratio(available, PERF_BRANCH_MISSES, -1, (double)phase->counters[PERF_BRANCH_MISSES], units);
+    printf("  %s\n", per_pixel ? "pixel" : "call");
+}
+
+int main(int argc, char** argv) {
+    int width = 1920;
+    int height = 1080;
+    double seconds = 2.0;
+    int threads = 0;
+    int pipes = 10;
+    int counters = 0;
+    const char* trace_path = NULL;
+    
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 < argc && strcmp(argv[i], "-w") == 0) {
+            width = atoi(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "-h") == 0) {
+            height = atoi(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "-t") == 0) {
+            seconds = atof(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "-threads") == 0) {
+            threads = atoi(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "-pipes") == 0) {
+            pipes = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-counters") == 0) {
+            counters = 1;
+        } else if (i + 1 < argc && strcmp(argv[i], "-trace") == 0) {
+            trace_path = argv[++i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    
+    static const int multipliers[] = { 1, 10, 100, 1000 };
+    
+    printf("%dx%d, %d pipes, %s, %.1f s per run\n", width, height, pipes,
+           threads > 0 ? "phased" : "serial", seconds);
+    
+    PerfCounters perf = { { -1, -1, -1, -1, -1 } };
+    if (counters && !perf_counters_open(&perf)) {
+        printf("Hardware counters unavailable (%s), reporting time only. perf_event_paranoid,\n"
+               "seccomp or a VM without a virtual PMU can hide them.\n", strerror(errno));
+        counters = 0;
+    }
+    if (counters) {
+        for (int i = 0; i < PERF_COUNTERS; i++) {
+            if (!((perf.available >> i) & 1)) printf("No %s counter on this machine\n", perf_counter_names[i]);
+        }
+        trace_counters_enable(1);
+    }
+    printf("%8s %10s %12s %14s\n", "steps", "frames", "frames/s", "steps/s");
+    
+    PipesContext* ctx = pipes_create();
+    if (!ctx) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    pipes_set_pipe_capacity(ctx, pipes);
+    if (threads > 0) {
+        pipes_set_worker_threads(ctx, threads);
+    }
+    
+    for (size_t m = 0; m < sizeof(multipliers) / sizeof(multipliers[0]); m++) {
+        int steps = multipliers[m];
+        pipes_init(ctx, width, height);
+        pipes_set_max_pipes(ctx, pipes);
+        pipes_set_spawn_rate(ctx, 50);
+        pipes_set_steps_per_frame(ctx, steps);
+        
+        // Run whole frames until the time budget is used up
+        PerfSample before, after;
+        if (counters) {
+            trace_counters_reset();
+            perf_counters_read(&perf, &before);
+        }
+        int frames = 0;
+        double start = now_seconds();
+        double elapsed = 0;
+        while (elapsed < seconds || frames < 3) {
+            pipes_update(ctx);
+            frames++;
+            elapsed = now_seconds() - start;
+        }
+        
+        printf("%8d %10d %12.1f %14.0f\n", steps, frames,
+               frames / elapsed, (double)frames * steps / elapsed);
+        if (!counters) continue;
+        
+        // Per phase when the build traces them, else whole frames, which
+        // then include the clock reads of the loop
+        TracePhase phases[MAX_PHASES];
+        int phase_count = trace_counters_get(phases, MAX_PHASES);
+        if (phase_count == 0) {
+            PerfSample total = { { 0 } };
+            perf_counters_read(&perf, &after);
+            perf_sample_add_delta(&total, &before, &after);
+            phases[0] = (TracePhase){ "frame", (uint64_t)frames, (uint64_t)(elapsed * 1e9) };
+            memcpy(phases[0].counters, total.values, sizeof(total.values));
+            phase_count = 1;
+        }
+        qsort(phases, (size_t)phase_count, sizeof(TracePhase), by_time);
+        printf("  %-19s %10s %11s %11s %11s %11s %11s\n", "phase", "calls", "ns/call", "IPC",
+               "L1D miss", "LLC miss", "br miss");
+        for (int i = 0; i < phase_count; i++) {
+            print_phase(&phases[i], perf.available, (double)width * height);
+        }
+    }
+    
+    pipes_destroy(ctx);
+    perf_counters_close(&perf);
+
+    if (trace_path && !trace_write(trace_path)) {
+        fprintf(stderr, "Cannot write trace to %s (needs a PIPES_TRACE build)\n", trace_path);
+    }
+    return 0;
+}
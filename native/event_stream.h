@@ -0,0 +1,213 @@
+// Draw-event streams for the native hosts (see src/draw_events.h): where a
+// recording host writes its events and a replaying host reads them from.
+//
+// A path is a file, a FIFO, a Unix socket, or "-" for stdin/stdout. A
+// recorder can also serve a socket itself (event_output_open() with serve
+// set): it listens on the path and sends every frame to each display that
+// connects, starting each one with a RESET of the scene as it is then.
+// Readers never block: they take what has arrived each frame and keep
+// following the source past its current end, so a display can tail a file
+// another host is still writing.
+
+#ifndef EVENT_STREAM_H
+#define EVENT_STREAM_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#define EVENT_OUTPUT_MAX_CLIENTS 16
+#define EVENT_OUTPUT_TIMEOUT_MS 1000 // A display that stops reading this long is dropped
+
+typedef struct {
+    int fd;
+    unsigned char* data; // Received, not yet replayed
+    size_t size;
+    size_t capacity;
+} EventInput;
+
+// Where a recording host writes: a single fd, or every display connected
+// to the socket it serves
+typedef struct {
+    int fd;           // File, FIFO, socket or stdout; -1 while serving
+    int listen_fd;    // -1 unless serving
+    const char* path; // Served socket, unlinked on close
+    int clients[EVENT_OUTPUT_MAX_CLIENTS];
+    int client_count;
+    int joining;      // The last joining clients still wait for their RESET
+} EventOutput;
+
+static inline int event_stream_address(const char* path, struct sockaddr_un* address) {
+    *address = (struct sockaddr_un){ 0 };
+    if (strlen(path) >= sizeof(address->sun_path)) return 0;
+    address->sun_family = AF_UNIX;
+    strcpy(address->sun_path, path);
+    return 1;
+}
+
+static inline int event_stream_connect(const char* path) {
+    struct sockaddr_un address;
+    if (!event_stream_address(path, &address)) return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd >= 0 && connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Listen on path, replacing the socket a previous recorder left behind but
+// never anything else
+static inline int event_stream_listen(const char* path) {
+    struct sockaddr_un address;
+    if (!event_stream_address(path, &address)) return -1;
+    struct stat info;
+    if (stat(path, &info) == 0 && (!S_ISSOCK(info.st_mode) || unlink(path) != 0)) return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (bind(fd, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(fd, EVENT_OUTPUT_MAX_CLIENTS) != 0) {
+        close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+// Returns the fd to read or write, -1 on failure
+static inline int event_stream_open(const char* path, int output) {
+    // A reader that goes away should stop the recording, not the process
+    if (output) signal(SIGPIPE, SIG_IGN);
+    if (strcmp(path, "-") == 0) return output ? STDOUT_FILENO : STDIN_FILENO;
+
+    struct stat info;
+    if (stat(path, &info) == 0 && S_ISSOCK(info.st_mode)) return event_stream_connect(path);
+    // FIFOs open without waiting for the other end only when reading
+    return output ? open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644) : open(path, O_RDONLY | O_NONBLOCK);
+}
+
+static inline int event_output_write(int fd, const unsigned char* data, size_t size) {
+    while (size > 0) {
+        ssize_t written = write(fd, data, size);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return 0;
+        data += written;
+        size -= (size_t)written;
+    }
+    return 1;
+}
+
+static inline int event_output_open(EventOutput* output, const char* path, int serve) {
+    *output = (EventOutput){ 0 };
+    output->fd = -1;
+    output->listen_fd = -1;
+    if (!serve) {
+        output->fd = event_stream_open(path, 1);
+        return output->fd >= 0;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    output->listen_fd = event_stream_listen(path);
+    output->path = path;
+    return output->listen_fd >= 0;
+}
+
+// Take the displays that connected since the last call, without waiting for
+// any. Returns how many are waiting for event_output_welcome().
+static inline int event_output_accept(EventOutput* output) {
+    if (output->listen_fd < 0) return 0;
+    while (output->client_count < EVENT_OUTPUT_MAX_CLIENTS) {
+        int fd = accept(output->listen_fd, NULL, NULL);
+        if (fd < 0 && errno == EINTR) continue;
+        if (fd < 0) break;
+        // Writes block, so the stream stays whole, but not for long
+        struct timeval timeout = { EVENT_OUTPUT_TIMEOUT_MS / 1000, (EVENT_OUTPUT_TIMEOUT_MS % 1000) * 1000 };
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        output->clients[output->client_count++] = fd;
+        output->joining++;
+    }
+    return output->joining;
+}
+
+static inline void event_output_drop(EventOutput* output, int client) {
+    close(output->clients[client]);
+    memmove(&output->clients[client], &output->clients[client + 1],
+            (size_t)(output->client_count - client - 1) * sizeof(int));
+    output->client_count--;
+}
+
+// Send a frame's events to every display that has had its RESET. Displays
+// that went away are dropped. Returns 0 once a single output is gone, which
+// never happens while serving.
+static inline int event_output_send(EventOutput* output, const unsigned char* data, size_t size) {
+    if (output->listen_fd < 0) return output->fd >= 0 && event_output_write(output->fd, data, size);
+    for (int i = output->client_count - output->joining - 1; i >= 0; i--) {
+        if (!event_output_write(output->clients[i], data, size)) event_output_drop(output, i);
+    }
+    return 1;
+}
+
+// Send the RESET the joining displays start from
+static inline void event_output_welcome(EventOutput* output, const unsigned char* data, size_t size) {
+    int first = output->client_count - output->joining;
+    output->joining = 0;
+    for (int i = output->client_count - 1; i >= first; i--) {
+        if (!event_output_write(output->clients[i], data, size)) event_output_drop(output, i);
+    }
+}
+
+static inline void event_output_close(EventOutput* output) {
+    if (output->fd > STDERR_FILENO) close(output->fd);
+    while (output->client_count > 0) event_output_drop(output, output->client_count - 1);
+    if (output->listen_fd >= 0) {
+        close(output->listen_fd);
+        unlink(output->path);
+    }
+    *output = (EventOutput){ 0 };
+    output->fd = -1;
+    output->listen_fd = -1;
+}
+
+static inline int event_input_open(EventInput* input, const char* path) {
+    *input = (EventInput){ 0 };
+    input->fd = event_stream_open(path, 0);
+    if (input->fd < 0) return 0;
+    fcntl(input->fd, F_SETFL, fcntl(input->fd, F_GETFL) | O_NONBLOCK);
+    return 1;
+}
+
+// Append whatever has arrived. Returns 0 only if memory runs out.
+static inline int event_input_fill(EventInput* input) {
+    for (;;) {
+        if (input->capacity - input->size < 65536) {
+            size_t capacity = input->capacity ? input->capacity * 2 : 1 << 20;
+            unsigned char* data = (unsigned char*)realloc(input->data, capacity);
+            if (!data) return 0;
+            input->data = data;
+            input->capacity = capacity;
+        }
+        ssize_t got = read(input->fd, input->data + input->size, input->capacity - input->size);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return 1; // Nothing more for now, or the writer is not done yet
+        input->size += (size_t)got;
+    }
+}
+
+// Drop the first size bytes once they have been replayed
+static inline void event_input_consume(EventInput* input, size_t size) {
+    memmove(input->data, input->data + size, input->size - size);
+    input->size -= size;
+}
+
+static inline void event_input_close(EventInput* input) {
+    if (input->fd > STDERR_FILENO) close(input->fd);
+    free(input->data);
+    *input = (EventInput){ 0 };
+}
+
+#endif
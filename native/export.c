@@ -0,0 +1,366 @@
+// Offline frame exporter. Renders a fixed number of frames as fast as the
+// CPU allows, with no pacing, and streams them to a file or stdout as Y4M
+// (4:2:0, for ffmpeg and most encoders) or raw RGBA.
+//
+// Frames are handed to a writer thread through two buffers, so the engine
+// renders and converts frame N+1 while frame N is being written.
+//
+// Built against the software engine (src/pipes.c) by default, or against the
+// offscreen path of the 3D engine with -DEXPORT_3D and raylib.
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#ifdef EXPORT_3D
+#include <raylib.h>
+#else
+#include "../src/pipes.h"
+#endif
+#include "../src/trace.h"
+
+#ifdef EXPORT_3D
+void pipes3d_init(int canvasWidth, int canvasHeight);
+void pipes3d_frame(void);
+void pipes3d_cleanup(void);
+void pipes3d_setStepsPerFrame(int steps);
+int pipes3d_readFrame(unsigned char* rgba, int width, int height);
+#endif
+
+typedef enum {
+    FORMAT_Y4M,
+    FORMAT_RGBA
+} Format;
+
+typedef struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    FILE* out;
+    Format format;
+    unsigned char* buffers[2];
+    size_t frame_size;
+    int filled[2]; // Buffer holds a frame waiting to be written
+    int finished; // No more frames will be submitted
+    int failed;
+} FrameWriter;
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "usage: %s [-w width] [-h height] [-n frames] [-fps n] [-steps n]\n"
+            "          [-warmup frames] [-format y4m|rgba] [-o file|-] [-trace file.json]\n",
+            prog);
+}
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// BT.601 limited range, 8-bit fixed point
+static inline unsigned char luma(int r, int g, int b) {
+    return (unsigned char)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+}
+
+static inline unsigned char chroma_u(int r, int g, int b) {
+    return (unsigned char)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+}
+
+static inline unsigned char chroma_v(int r, int g, int b) {
+    return (unsigned char)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+}
+
+// One row of luma. SSE2 builds convert eight pixels per iteration: the
+// channels are widened to 16 bits and multiplied and paired up with madd.
+static void convert_luma_row(const unsigned char* rgba, unsigned char* y, int width) {
+    int x = 0;
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i coefficients = _mm_setr_epi16(66, 129, 25, 0, 66, 129, 25, 0);
+    const __m128i bias = _mm_set1_epi32(128 + (16 << 8));
+    for (; x + 8 <= width; x += 8) {
+        __m128i sums[2];
+        for (int half = 0; half < 2; half++) {
+            __m128i pixels = _mm_loadu_si128((const __m128i*)(rgba + (x + half * 4) * 4));
+            // Per pixel: r*66 + g*129 and b*25 + a*0 as adjacent 32-bit lanes
+            __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(pixels, zero), coefficients);
+            __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(pixels, zero), coefficients);
+            __m128 even = _mm_shuffle_ps(_mm_castsi128_ps(lo), _mm_castsi128_ps(hi), _MM_SHUFFLE(2, 0, 2, 0));
+            __m128 odd = _mm_shuffle_ps(_mm_castsi128_ps(lo), _mm_castsi128_ps(hi), _MM_SHUFFLE(3, 1, 3, 1));
+            __m128i sum = _mm_add_epi32(_mm_castps_si128(even), _mm_castps_si128(odd));
+            sums[half] = _mm_srai_epi32(_mm_add_epi32(sum, bias), 8);
+        }
+        __m128i words = _mm_packs_epi32(sums[0], sums[1]);
+        _mm_storel_epi64((__m128i*)(y + x), _mm_packus_epi16(words, words));
+    }
+#endif
+    for (; x < width; x++) {
+        const unsigned char* px = rgba + x * 4;
+        y[x] = luma(px[0], px[1], px[2]);
+    }
+}
+
+// RGBA to planar Y4M 4:2:0, chroma from the average of each 2x2 block
+static void convert_frame_yuv420(const unsigned char* rgba, unsigned char* out, int width, int height) {
+    int chroma_width = (width + 1) / 2;
+    int chroma_height = (height + 1) / 2;
+    unsigned char* y_plane = out;
+    unsigned char* u_plane = y_plane + (size_t)width * height;
+    unsigned char* v_plane = u_plane + (size_t)chroma_width * chroma_height;
+
+    for (int row = 0; row < height; row++) {
+        convert_luma_row(rgba + (size_t)row * width * 4, y_plane + (size_t)row * width, width);
+    }
+
+    for (int cy = 0; cy < chroma_height; cy++) {
+        const unsigned char* row0 = rgba + (size_t)(cy * 2) * width * 4;
+        const unsigned char* row1 = cy * 2 + 1 < height ? row0 + (size_t)width * 4 : row0;
+        unsigned char* u = u_plane + (size_t)cy * chroma_width;
+        unsigned char* v = v_plane + (size_t)cy * chroma_width;
+        // Full 2x2 blocks without per-pixel edge checks so the loop vectorizes
+        int cx = 0;
+        for (; cx < width / 2; cx++) {
+            const unsigned char* a = row0 + cx * 8;
+            const unsigned char* b = row1 + cx * 8;
+            int r = (a[0] + a[4] + b[0] + b[4] + 2) >> 2;
+            int g = (a[1] + a[5] + b[1] + b[5] + 2) >> 2;
+            int bl = (a[2] + a[6] + b[2] + b[6] + 2) >> 2;
+            u[cx] = chroma_u(r, g, bl);
+            v[cx] = chroma_v(r, g, bl);
+        }
+        // Odd widths: the last column averages vertically only
+        if (cx < chroma_width) {
+            const unsigned char* a = row0 + cx * 8;
+            const unsigned char* b = row1 + cx * 8;
+            int r = (a[0] + b[0] + 1) >> 1;
+            int g = (a[1] + b[1] + 1) >> 1;
+            int bl = (a[2] + b[2] + 1) >> 1;
+            u[cx] = chroma_u(r, g, bl);
+            v[cx] = chroma_v(r, g, bl);
+        }
+    }
+}
+
+static void* writer_main(void* arg) {
+    FrameWriter* writer = (FrameWriter*)arg;
+    int slot = 0;
+
+    for (;;) {
+        pthread_mutex_lock(&writer->lock);
+        while (!writer->filled[slot] && !writer->finished) {
+            pthread_cond_wait(&writer->changed, &writer->lock);
+        }
+        int has_frame = writer->filled[slot];
+        pthread_mutex_unlock(&writer->lock);
+        if (!has_frame) break;
+
+        if (!writer->failed) {
+            TRACE_SCOPE("write");
+            if (writer->format == FORMAT_Y4M && fputs("FRAME\n", writer->out) == EOF) {
+                writer->failed = 1;
+            }
+            if (fwrite(writer->buffers[slot], 1, writer->frame_size, writer->out) != writer->frame_size) {
+                writer->failed = 1;
+            }
+        }
+
+        pthread_mutex_lock(&writer->lock);
+        writer->filled[slot] = 0;
+        pthread_cond_signal(&writer->changed);
+        pthread_mutex_unlock(&writer->lock);
+        slot ^= 1;
+    }
+    return NULL;
+}
+
+static int writer_start(FrameWriter* writer, FILE* out, Format format, size_t frame_size) {
+    memset(writer, 0, sizeof(*writer));
+    writer->out = out;
+    writer->format = format;
+    writer->frame_size = frame_size;
+    writer->buffers[0] = (unsigned char*)malloc(frame_size);
+    writer->buffers[1] = (unsigned char*)malloc(frame_size);
+    if (!writer->buffers[0] || !writer->buffers[1]) return 0;
+
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->changed, NULL);
+    return pthread_create(&writer->thread, NULL, writer_main, writer) == 0;
+}
+
+// Wait until the writer is done with buffer slot, then hand it out for filling
+static unsigned char* writer_acquire(FrameWriter* writer, int slot) {
+    pthread_mutex_lock(&writer->lock);
+    while (writer->filled[slot]) {
+        pthread_cond_wait(&writer->changed, &writer->lock);
+    }
+    pthread_mutex_unlock(&writer->lock);
+    return writer->buffers[slot];
+}
+
+static void writer_submit(FrameWriter* writer, int slot) {
+    pthread_mutex_lock(&writer->lock);
+    writer->filled[slot] = 1;
+    pthread_cond_signal(&writer->changed);
+    pthread_mutex_unlock(&writer->lock);
+}
+
+// Flush the remaining frames; returns 0 if any write failed
+static int writer_finish(FrameWriter* writer) {
+    pthread_mutex_lock(&writer->lock);
+    writer->finished = 1;
+    pthread_cond_signal(&writer->changed);
+    pthread_mutex_unlock(&writer->lock);
+    pthread_join(writer->thread, NULL);
+
+    pthread_mutex_destroy(&writer->lock);
+    pthread_cond_destroy(&writer->changed);
+    free(writer->buffers[0]);
+    free(writer->buffers[1]);
+    return !writer->failed && fflush(writer->out) == 0;
+}
+
+int main(int argc, char** argv) {
+    int width = 1920;
+    int height = 1080;
+    int frames = 600;
+    int fps = 60;
+    int steps = 1;
+    int warmup = 0;
+    const char* output = "-";
+    const char* trace_path = NULL;
+    Format format = FORMAT_Y4M;
+
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 < argc && strcmp(argv[i], "-w") == 0) {
+            width = atoi(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "-h") == 0) {
+            height = atoi(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "-n") == 0) {
+            frames = atoi(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "-fps") == 0) {
+            fps = atoi(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "-steps") == 0) {
+            steps = atoi(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "-warmup") == 0) {
+            warmup = atoi(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "-format") == 0) {
+            const char* name = argv[++i];
+            if (strcmp(name, "y4m") == 0) {
+                format = FORMAT_Y4M;
+            } else if (strcmp(name, "rgba") == 0) {
+                format = FORMAT_RGBA;
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (i + 1 < argc && strcmp(argv[i], "-o") == 0) {
+            output = argv[++i];
+        } else if (i + 1 < argc && strcmp(argv[i], "-trace") == 0) {
+            trace_path = argv[++i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (width <= 0 || height <= 0 || frames < 0 || fps < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    FILE* out = strcmp(output, "-") == 0 ? stdout : fopen(output, "wb");
+    if (!out) {
+        perror(output);
+        return 1;
+    }
+
+#ifdef EXPORT_3D
+    // Offscreen: the window only provides the GL context
+    SetConfigFlags(FLAG_WINDOW_HIDDEN);
+    SetTraceLogLevel(LOG_WARNING);
+    pipes3d_init(width, height);
+    SetTargetFPS(0);
+    pipes3d_setStepsPerFrame(steps);
+    unsigned char* rgba = (unsigned char*)malloc((size_t)width * height * 4);
+    if (!rgba) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+#else
+    PipesContext* pipes = pipes_create();
+    if (!pipes) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    pipes_init(pipes, width, height);
+    pipes_set_steps_per_frame(pipes, steps);
+#endif
+
+    size_t frame_size = format == FORMAT_Y4M
+        ? (size_t)width * height + 2 * (size_t)((width + 1) / 2) * ((height + 1) / 2)
+        : (size_t)width * height * 4;
+
+    FrameWriter writer;
+    if (!writer_start(&writer, out, format, frame_size)) {
+        fprintf(stderr, "Cannot start the writer thread\n");
+        return 1;
+    }
+    if (format == FORMAT_Y4M) {
+        fprintf(out, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420\n", width, height, fps);
+    }
+
+    double start = now_seconds();
+    for (int frame = -warmup; frame < frames; frame++) {
+        if (frame == 0) start = now_seconds(); // Warmup is not part of the timing
+#ifdef EXPORT_3D
+        pipes3d_frame();
+        if (frame < 0) continue;
+        if (!pipes3d_readFrame(rgba, width, height)) {
+            fprintf(stderr, "Cannot read back frame %d\n", frame);
+            break;
+        }
+#else
+        pipes_update(pipes);
+        if (frame < 0) continue;
+        const unsigned char* rgba = pipes_get_framebuffer(pipes);
+#endif
+
+        int slot = frame & 1;
+        unsigned char* buffer = writer_acquire(&writer, slot);
+        if (format == FORMAT_Y4M) {
+            TRACE_SCOPE("convert");
+            convert_frame_yuv420(rgba, buffer, width, height);
+        } else {
+            memcpy(buffer, rgba, frame_size);
+        }
+        writer_submit(&writer, slot);
+    }
+
+    int ok = writer_finish(&writer);
+    double elapsed = now_seconds() - start;
+    if (out != stdout) fclose(out);
+
+#ifdef EXPORT_3D
+    free(rgba);
+    pipes3d_cleanup();
+#else
+    pipes_destroy(pipes);
+#endif
+
+    if (!ok) {
+        fprintf(stderr, "Writing %s failed\n", output);
+        return 1;
+    }
+
+    if (trace_path && !trace_write(trace_path)) {
+        fprintf(stderr, "Cannot write trace to %s (needs a PIPES_TRACE build)\n", trace_path);
+    }
+    fprintf(stderr, "%d frames of %dx%d in %.2f s (%.1f frames/s)\n",
+            frames, width, height, elapsed, elapsed > 0 ? frames / elapsed : 0.0);
+    return 0;
+}
@@ -0,0 +1,171 @@
+// Ring of frames in POSIX shared memory (/dev/shm), so another process such
+// as a compositor or viewer can map it and take finished frames straight
+// from where the engine drew them. native/shm_host.c writes one and
+// native/shm_view.c is a minimal reader.
+//
+// Layout, native endianness: a FrameRingHeader, then from FRAME_RING_PAGE
+// on slot_count slots every slot_size bytes. Each slot is a FrameSlotHeader
+// followed, at FRAME_RING_SLOT_HEADER, by height rows of stride bytes of
+// RGBA. The writer draws frame n into slot (n - 1) % slot_count while the
+// others keep the frames before it.
+//
+// A slot reads WRITING while its pixels change and READY with its frame
+// number once they are complete, and latest is the newest READY frame.
+// Readers take latest, check that its slot is READY with that number, read,
+// and check again afterwards; if the second check fails the writer caught up
+// with them and the pixels may be torn. With more slots readers get longer.
+
+#ifndef FRAME_RING_H
+#define FRAME_RING_H
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define FRAME_RING_MAGIC 0x52504950 // "PIPR"
+#define FRAME_RING_VERSION 1
+#define FRAME_RING_PAGE 4096
+#define FRAME_RING_SLOT_HEADER 64 // Pixels start a cache line into each slot
+
+#define FRAME_SLOT_EMPTY 0
+#define FRAME_SLOT_WRITING 1
+#define FRAME_SLOT_READY 2
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slot_count;
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride; // Bytes per row
+    uint64_t slot_size; // Bytes from one slot to the next, a multiple of FRAME_RING_PAGE
+    uint64_t latest; // Newest READY frame, 0 before the first
+} FrameRingHeader;
+
+typedef struct {
+    uint32_t state; // FRAME_SLOT_*
+    uint32_t reserved;
+    uint64_t frame; // Frame in the slot, numbered from 1
+} FrameSlotHeader;
+
+typedef struct {
+    FrameRingHeader* header;
+    size_t size;
+    int owner; // Created the object, so removes it on close
+    char name[256];
+} FrameRing;
+
+static inline FrameSlotHeader* frame_ring_slot(const FrameRing* ring, uint64_t frame) {
+    uint64_t slot = (frame - 1) % ring->header->slot_count;
+    return (FrameSlotHeader*)((unsigned char*)ring->header + FRAME_RING_PAGE + slot * ring->header->slot_size);
+}
+
+static inline unsigned char* frame_ring_pixels(const FrameRing* ring, uint64_t frame) {
+    return (unsigned char*)frame_ring_slot(ring, frame) + FRAME_RING_SLOT_HEADER;
+}
+
+// Create, or replace, the object called name ("/pipes"). Returns 0 on
+// failure.
+static inline int frame_ring_create(FrameRing* ring, const char* name, int width, int height, int slots) {
+    *ring = (FrameRing){ 0 };
+    if (width <= 0 || height <= 0 || slots < 2 || strlen(name) >= sizeof(ring->name)) return 0;
+
+    uint64_t stride = (uint64_t)width * 4;
+    uint64_t slot_size = (FRAME_RING_SLOT_HEADER + stride * height + FRAME_RING_PAGE - 1) / FRAME_RING_PAGE * FRAME_RING_PAGE;
+    size_t size = FRAME_RING_PAGE + (size_t)(slot_size * slots);
+
+    shm_unlink(name);
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) return 0;
+    void* memory = ftruncate(fd, (off_t)size) == 0
+        ? mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (memory == MAP_FAILED) {
+        shm_unlink(name);
+        return 0;
+    }
+
+    // Fresh objects are zeroed: every slot EMPTY, latest 0. The magic goes
+    // last, so readers never see a half-written header.
+    ring->header = (FrameRingHeader*)memory;
+    ring->size = size;
+    ring->owner = 1;
+    strcpy(ring->name, name);
+    ring->header->version = FRAME_RING_VERSION;
+    ring->header->slot_count = (uint32_t)slots;
+    ring->header->width = (uint32_t)width;
+    ring->header->height = (uint32_t)height;
+    ring->header->stride = (uint32_t)stride;
+    ring->header->slot_size = slot_size;
+    __atomic_store_n(&ring->header->magic, FRAME_RING_MAGIC, __ATOMIC_RELEASE);
+    return 1;
+}
+
+// Map an existing ring for reading. Returns 0 if there is none or it is not
+// a ring this code understands.
+static inline int frame_ring_open(FrameRing* ring, const char* name) {
+    *ring = (FrameRing){ 0 };
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) return 0;
+    struct stat info;
+    void* memory = fstat(fd, &info) == 0 && info.st_size >= FRAME_RING_PAGE
+        ? mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (memory == MAP_FAILED) return 0;
+
+    ring->header = (FrameRingHeader*)memory;
+    ring->size = (size_t)info.st_size;
+    const FrameRingHeader* header = ring->header;
+    if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != FRAME_RING_MAGIC ||
+        header->version != FRAME_RING_VERSION || header->slot_count < 2 ||
+        header->slot_size < FRAME_RING_SLOT_HEADER + (uint64_t)header->stride * header->height ||
+        FRAME_RING_PAGE + header->slot_size * header->slot_count > ring->size) {
+        munmap(memory, ring->size);
+        *ring = (FrameRing){ 0 };
+        return 0;
+    }
+    return 1;
+}
+
+static inline void frame_ring_close(FrameRing* ring) {
+    if (ring->header) munmap(ring->header, ring->size);
+    if (ring->owner) shm_unlink(ring->name);
+    *ring = (FrameRing){ 0 };
+}
+
+// Writer: the pixels frame goes to, marked WRITING. The slot may still be
+// WRITING from an earlier call for the same frame.
+static inline unsigned char* frame_ring_begin(FrameRing* ring, uint64_t frame) {
+    FrameSlotHeader* slot = frame_ring_slot(ring, frame);
+    __atomic_store_n(&slot->state, FRAME_SLOT_WRITING, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE); // Before any pixel changes
+    return (unsigned char*)slot + FRAME_RING_SLOT_HEADER;
+}
+
+// Writer: frame is complete
+static inline void frame_ring_publish(FrameRing* ring, uint64_t frame) {
+    FrameSlotHeader* slot = frame_ring_slot(ring, frame);
+    __atomic_store_n(&slot->frame, frame, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->state, FRAME_SLOT_READY, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->header->latest, frame, __ATOMIC_RELEASE);
+}
+
+// Reader: whether frame is complete in its slot. Call before reading its
+// pixels, then with after set to check that they did not change meanwhile.
+static inline int frame_ring_valid(const FrameRing* ring, uint64_t frame, int after) {
+    if (frame == 0) return 0;
+    FrameSlotHeader* slot = frame_ring_slot(ring, frame);
+    if (after) __atomic_thread_fence(__ATOMIC_ACQUIRE); // The pixel reads come first
+    return __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE) == FRAME_SLOT_READY &&
+           __atomic_load_n(&slot->frame, __ATOMIC_RELAXED) == frame;
+}
+
+// Reader: the newest complete frame, 0 if none yet
+static inline uint64_t frame_ring_latest(const FrameRing* ring) {
+    return __atomic_load_n(&ring->header->latest, __ATOMIC_ACQUIRE);
+}
+
+#endif
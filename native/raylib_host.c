@@ -0,0 +1,186 @@
+// Native desktop host for the raylib engines (src/pipes_3d.c and
+// src/pipes_2d_raylib.c). Drives the same per-frame exports the browser
+// calls, from a regular main loop with vsync. -record, -serve and -replay
+// work as in x11_host.c, with the stream's engine matching -2d or -3d.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <raylib.h>
+#include "../src/trace.h"
+#include "event_stream.h"
+
+void pipes2d_init(int canvasWidth, int canvasHeight);
+void pipes2d_frame(void);
+void pipes2d_resize(int width, int height);
+void pipes2d_cleanup(void);
+int pipes2d_replayFrame(const unsigned char* data, int size);
+void pipes2d_setEventRecording(int enabled);
+unsigned char* pipes2d_getEvents(void);
+int pipes2d_getEventSize(void);
+void pipes2d_clearEvents(void);
+
+void pipes3d_init(int canvasWidth, int canvasHeight);
+void pipes3d_frame(void);
+void pipes3d_resize(int width, int height);
+void pipes3d_cleanup(void);
+void pipes3d_mouseDown(int x, int y);
+void pipes3d_mouseUp(void);
+void pipes3d_mouseMove(int x, int y);
+int pipes3d_replayFrame(const unsigned char* data, int size);
+void pipes3d_setEventRecording(int enabled);
+unsigned char* pipes3d_getEvents(void);
+int pipes3d_getEventSize(void);
+void pipes3d_clearEvents(void);
+
+static void usage(const char* prog) {
+    fprintf(stderr, "usage: %s [-2d|-3d] [-fullscreen] [-geometry <w>x<h>] [-trace file.json]\n"
+                    "          [-record <path>|- | -serve <socket> | -replay <path>|-]\n", prog);
+}
+
+int main(int argc, char** argv) {
+    int use_3d = 1;
+    int fullscreen = 0;
+    int width = 1280;
+    int height = 720;
+    const char* trace_path = NULL;
+    const char* record_path = NULL;
+    const char* replay_path = NULL;
+    int serve = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-2d") == 0) {
+            use_3d = 0;
+        } else if (strcmp(argv[i], "-3d") == 0) {
+            use_3d = 1;
+        } else if (strcmp(argv[i], "-fullscreen") == 0) {
+            fullscreen = 1;
+        } else if (i + 1 < argc && strcmp(argv[i], "-geometry") == 0) {
+            sscanf(argv[++i], "%dx%d", &width, &height);
+        } else if (i + 1 < argc && strcmp(argv[i], "-trace") == 0) {
+            trace_path = argv[++i];
+        } else if (i + 1 < argc && (strcmp(argv[i], "-record") == 0 || strcmp(argv[i], "-serve") == 0)) {
+            serve = strcmp(argv[i], "-serve") == 0;
+            record_path = argv[++i];
+        } else if (i + 1 < argc && strcmp(argv[i], "-replay") == 0) {
+            replay_path = argv[++i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (record_path && replay_path) {
+        usage(argv[0]);
+        return 1;
+    }
+    EventInput input = { 0 };
+    EventOutput output;
+    int recording = record_path != NULL;
+    if (replay_path && !event_input_open(&input, replay_path)) {
+        fprintf(stderr, "Cannot open %s\n", replay_path);
+        return 1;
+    }
+    if (recording && !event_output_open(&output, record_path, serve)) {
+        fprintf(stderr, "Cannot open %s\n", record_path);
+        return 1;
+    }
+
+    // The engines add their own flags on top of these
+    SetConfigFlags(FLAG_VSYNC_HINT | (fullscreen ? FLAG_FULLSCREEN_MODE : 0));
+
+    if (use_3d) {
+        pipes3d_init(width, height);
+    } else {
+        pipes2d_init(width, height);
+    }
+    if (recording) {
+        if (use_3d) {
+            pipes3d_setEventRecording(1);
+        } else {
+            pipes2d_setEventRecording(1);
+        }
+    }
+
+    while (!WindowShouldClose()) {
+        if (IsWindowResized()) {
+            if (use_3d) {
+                pipes3d_resize(GetScreenWidth(), GetScreenHeight());
+            } else {
+                pipes2d_resize(GetScreenWidth(), GetScreenHeight());
+            }
+        }
+
+        if (use_3d) {
+            Vector2 mouse = GetMousePosition();
+            if (IsMouseButtonPressed(MOUSE_BUTTON_LEFT)) pipes3d_mouseDown(mouse.x, mouse.y);
+            if (IsMouseButtonReleased(MOUSE_BUTTON_LEFT)) pipes3d_mouseUp();
+            pipes3d_mouseMove(mouse.x, mouse.y);
+        }
+
+        if (replay_path) {
+            // One frame per vsync; the replay shows the last one again
+            // until the next has arrived
+            if (!event_input_fill(&input)) break;
+            int used = use_3d ? pipes3d_replayFrame(input.data, (int)input.size)
+                              : pipes2d_replayFrame(input.data, (int)input.size);
+            event_input_consume(&input, (size_t)used);
+            continue;
+        }
+
+        if (use_3d) {
+            pipes3d_frame();
+        } else {
+            pipes2d_frame();
+        }
+        if (recording) {
+            unsigned char* events = use_3d ? pipes3d_getEvents() : pipes2d_getEvents();
+            int size = use_3d ? pipes3d_getEventSize() : pipes2d_getEventSize();
+            if (!event_output_send(&output, events, (size_t)size)) {
+                fprintf(stderr, "Event stream closed, recording stopped\n");
+                event_output_close(&output);
+                recording = 0;
+                if (use_3d) {
+                    pipes3d_setEventRecording(0);
+                } else {
+                    pipes2d_setEventRecording(0);
+                }
+                continue;
+            }
+            if (use_3d) {
+                pipes3d_clearEvents();
+            } else {
+                pipes2d_clearEvents();
+            }
+
+            // Restarting the recording logs a RESET of the scene as it is
+            // now, which only the displays that just connected get
+            if (event_output_accept(&output)) {
+                if (use_3d) {
+                    pipes3d_setEventRecording(0);
+                    pipes3d_setEventRecording(1);
+                    event_output_welcome(&output, pipes3d_getEvents(), (size_t)pipes3d_getEventSize());
+                    pipes3d_clearEvents();
+                } else {
+                    pipes2d_setEventRecording(0);
+                    pipes2d_setEventRecording(1);
+                    event_output_welcome(&output, pipes2d_getEvents(), (size_t)pipes2d_getEventSize());
+                    pipes2d_clearEvents();
+                }
+            }
+        }
+    }
+    event_input_close(&input);
+    if (recording) event_output_close(&output);
+
+    if (use_3d) {
+        pipes3d_cleanup();
+    } else {
+        pipes2d_cleanup();
+    }
+
+    if (trace_path && !trace_write(trace_path)) {
+        fprintf(stderr, "Cannot write trace to %s (needs a PIPES_TRACE build)\n", trace_path);
+    }
+    return 0;
+}
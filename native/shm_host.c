@@ -0,0 +1,150 @@
+// Shared-memory host for the software engine (src/pipes.c).
+//
+// Renders into a frame ring in POSIX shared memory (native/frame_ring.h)
+// instead of a window, so a compositor, recorder or viewer in another
+// process maps the ring and takes frames where the engine drew them. The
+// engine fades each frame straight into the next ring slot, which costs the
+// same as fading in place, so handing frames over adds no copy.
+//
+// Frames the engine reports unchanged are not published, and while the
+// image is black with no pipes the loop ticks at IDLE_FPS, running the frames
+// it slept through so pipes spawn as often as at the full rate.
+// native/shm_view.c is a minimal reader.
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../src/pipes.h"
+#include "../src/trace.h"
+#include "frame_ring.h"
+
+#define IDLE_FPS 4
+
+static volatile sig_atomic_t running = 1;
+
+static void stop(int signal_number) {
+    (void)signal_number;
+    running = 0;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "usage: %s [-name /pipes] [-buffers n] [-w width] [-h height] [-fps n] [-steps n]\n"
+            "          [-n frames] [-trace file.json]\n",
+            prog);
+}
+
+static void add_nanoseconds(struct timespec* t, long ns) {
+    t->tv_nsec += ns;
+    while (t->tv_nsec >= 1000000000L) {
+        t->tv_nsec -= 1000000000L;
+        t->tv_sec++;
+    }
+}
+
+int main(int argc, char** argv) {
+    const char* name = "/pipes";
+    int buffers = 3;
+    int width = 1920;
+    int height = 1080;
+    int fps = 60;
+    int steps = 1;
+    long frames = 0; // 0 runs until interrupted
+    const char* trace_path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 < argc && strcmp(argv[i], "-name") == 0) {
+            name = argv[++i];
+        } else if (i + 1 < argc && strcmp(argv[i], "-buffers") == 0) {
+            buffers = atoi(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "-w") == 0) {
+            width = atoi(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "-h") == 0) {
+            height = atoi(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "-fps") == 0) {
+            fps = atoi(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "-steps") == 0) {
+            steps = atoi(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "-n") == 0) {
+            frames = atol(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "-trace") == 0) {
+            trace_path = argv[++i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (width <= 0 || height <= 0 || fps < 1 || buffers < 2 || frames < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    FrameRing ring;
+    if (!frame_ring_create(&ring, name, width, height, buffers)) {
+        fprintf(stderr, "Cannot create a %d x %dx%d frame ring at %s: %s\n",
+                buffers, width, height, name, strerror(errno));
+        return 1;
+    }
+    PipesContext* pipes = pipes_create();
+    if (!pipes) {
+        fprintf(stderr, "Out of memory\n");
+        frame_ring_close(&ring);
+        return 1;
+    }
+    pipes_init(pipes, width, height);
+    pipes_set_steps_per_frame(pipes, steps);
+
+    // Stop cleanly so the ring is unlinked
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+
+    long frame_ns = 1000000000L / fps;
+    int idle_frames = fps > IDLE_FPS ? fps / IDLE_FPS : 1;
+    int due = 1; // Frames of time the next tick covers
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+    // An unchanged frame stays in its slot unpublished and the next one
+    // overwrites it, so readers keep the last published frame meanwhile
+    uint64_t frame = 1;
+    while (running && (frames == 0 || frame <= (uint64_t)frames)) {
+        // Spawns are rolled once per frame, so an idle tick runs every frame
+        // it stood for, all into the same slot. They cost next to nothing
+        // while black.
+        pipes_set_frame_target(pipes, frame_ring_begin(&ring, frame));
+        int changed = 0;
+        int state = 0;
+        for (int i = 0; i < due; i++) {
+            pipes_update(pipes);
+            state = pipes_get_frame_state(pipes);
+            changed |= !(state & PIPES_FRAME_UNCHANGED);
+        }
+        if (changed) {
+            frame_ring_publish(&ring, frame++);
+        }
+        due = !changed && (state & PIPES_FRAME_BLACK) ? idle_frames : 1;
+
+        // Sleep to the next deadline; after a long stall start over from now
+        // instead of bursting frames to catch up
+        add_nanoseconds(&deadline, due * frame_ns);
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (now.tv_sec > deadline.tv_sec + 1) {
+            deadline = now;
+        }
+        while (running && clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR) {
+        }
+    }
+
+    // The engine may still point into the ring
+    pipes_destroy(pipes);
+    frame_ring_close(&ring);
+
+    if (trace_path && !trace_write(trace_path)) {
+        fprintf(stderr, "Cannot write trace to %s (needs a PIPES_TRACE build)\n", trace_path);
+    }
+    return 0;
+}
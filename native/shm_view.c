@@ -0,0 +1,131 @@
+// Reference reader for the shared-memory frame ring (native/frame_ring.h)
+// that build/native/pipes_shm writes.
+//
+// Polls for the newest frame, copies it out and checks afterwards that the
+// writer did not reuse its slot meanwhile. Prints once a second how many
+// frames it took, skipped and found torn, and can save the last frame it
+// took as a PPM image.
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "frame_ring.h"
+
+static volatile sig_atomic_t running = 1;
+
+static void stop(int signal_number) {
+    (void)signal_number;
+    running = 0;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr, "usage: %s [-name /pipes] [-seconds n] [-o last.ppm]\n", prog);
+}
+
+static double now_seconds(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec + (double)t.tv_nsec * 1e-9;
+}
+
+static int write_ppm(const char* path, const unsigned char* rgba, int width, int height) {
+    FILE* out = fopen(path, "wb");
+    if (!out) return 0;
+    fprintf(out, "P6\n%d %d\n255\n", width, height);
+    for (int i = 0; i < width * height; i++) {
+        fwrite(rgba + (size_t)i * 4, 1, 3, out);
+    }
+    return fclose(out) == 0;
+}
+
+int main(int argc, char** argv) {
+    const char* name = "/pipes";
+    const char* output = NULL;
+    double seconds = 0; // 0 runs until interrupted
+
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 < argc && strcmp(argv[i], "-name") == 0) {
+            name = argv[++i];
+        } else if (i + 1 < argc && strcmp(argv[i], "-seconds") == 0) {
+            seconds = atof(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "-o") == 0) {
+            output = argv[++i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    FrameRing ring;
+    if (!frame_ring_open(&ring, name)) {
+        fprintf(stderr, "No frame ring at %s\n", name);
+        return 1;
+    }
+    const FrameRingHeader* header = ring.header;
+    int width = (int)header->width;
+    int height = (int)header->height;
+    size_t size = (size_t)header->stride * header->height;
+    unsigned char* pixels = (unsigned char*)malloc(size);
+    if (!pixels) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    printf("%s: %dx%d, %u buffers\n", name, width, height, header->slot_count);
+
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+
+    uint64_t last = 0; // Newest frame taken
+    long taken = 0, skipped = 0, torn = 0;
+    long total_taken = 0, total_skipped = 0, total_torn = 0;
+    double start = now_seconds();
+    double report = start + 1;
+    struct timespec poll = { 0, 1000000 };
+
+    while (running && (seconds <= 0 || now_seconds() - start < seconds)) {
+        uint64_t frame = frame_ring_latest(&ring);
+        if (frame != last && frame_ring_valid(&ring, frame, 0)) {
+            memcpy(pixels, frame_ring_pixels(&ring, frame), size);
+            if (frame_ring_valid(&ring, frame, 1)) {
+                if (last && frame > last + 1) skipped += (long)(frame - last - 1);
+                taken++;
+                last = frame;
+            } else {
+                torn++; // Retried on the next poll with whatever is newest then
+            }
+        } else {
+            nanosleep(&poll, NULL);
+        }
+
+        double now = now_seconds();
+        if (now >= report) {
+            printf("frame %llu: %ld taken, %ld skipped, %ld torn\n",
+                   (unsigned long long)last, taken, skipped, torn);
+            fflush(stdout);
+            total_taken += taken;
+            total_skipped += skipped;
+            total_torn += torn;
+            taken = skipped = torn = 0;
+            report = now + 1;
+        }
+    }
+    total_taken += taken;
+    total_skipped += skipped;
+    total_torn += torn;
+    printf("total: %ld taken, %ld skipped, %ld torn\n", total_taken, total_skipped, total_torn);
+
+    int status = 0;
+    if (output && last) {
+        if (!write_ppm(output, pixels, width, height)) {
+            fprintf(stderr, "Cannot write %s: %s\n", output, strerror(errno));
+            status = 1;
+        }
+    }
+    free(pixels);
+    frame_ring_close(&ring);
+    return status;
+}
@@ -0,0 +1,377 @@
+// Native X11 host for the software engine (src/pipes.c).
+//
+// Runs standalone in its own window, or as an xscreensaver hack drawing into
+// a window it is handed: -window-id <id>, or the XSCREENSAVER_WINDOW
+// environment variable. -root draws on that window too when xscreensaver sets
+// it, then on a virtual root, then on the real root. Plain X11 has no vsync, so frames are paced with
+// absolute deadlines at the requested rate.
+//
+// -record <path> writes the engine's draw events (src/draw_events.h) to a
+// file, FIFO or Unix socket, -serve <path> listens on a Unix socket and sends
+// them to every display that connects, and -replay <path> shows such a
+// stream instead of simulating, so one simulation can drive several screens.
+//
+// Frames the engine reports unchanged are not uploaded, and while the screen
+// is black with no pipes the loop ticks at IDLE_FPS until one spawns. Each
+// idle tick runs the frames it slept through, so pipes spawn as often as at
+// the full rate.
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <X11/Xlib.h>
+#include <X11/Xatom.h>
+#include <X11/Xutil.h>
+#include <X11/keysym.h>
+#include "../src/pipes.h"
+#include "../src/trace.h"
+#include "event_stream.h"
+
+#define IDLE_FPS 4
+
+typedef struct {
+    PipesContext* pipes;
+    Display* display;
+    Window window;
+    GC gc;
+    XImage* image;
+    int width;
+    int height;
+    int owns_window;
+    int replay; // Frames come from the input stream, which also sets their size
+    EventInput input;
+    int recording;
+    EventOutput output;
+} Host;
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "usage: %s [-window-id <id>] [-root] [-fps <n>] [-geometry <w>x<h>] [-trace file.json]\n"
+            "          [-record <path>|- | -serve <socket> | -replay <path>|-]\n",
+            prog);
+}
+
+// What -root draws on. Under xscreensaver that is the window it hands over,
+// since it covers the real root; window managers with a virtual root mark it
+// with __SWM_VROOT, as vroot.h looks it up. Otherwise the real root.
+static Window root_target(Display* display, int screen, const char* env_window) {
+    Window root = RootWindow(display, screen);
+    if (env_window) return (Window)strtoul(env_window, NULL, 0);
+
+    Atom vroot = XInternAtom(display, "__SWM_VROOT", False);
+    Window root_return, parent;
+    Window* children = NULL;
+    unsigned int count = 0;
+    Window found = root;
+    if (XQueryTree(display, root, &root_return, &parent, &children, &count)) {
+        for (unsigned int i = 0; i < count && found == root; i++) {
+            Atom type;
+            int format;
+            unsigned long items, after;
+            unsigned char* data = NULL;
+            if (XGetWindowProperty(display, children[i], vroot, 0, 1, False, XA_WINDOW, &type, &format,
+                                   &items, &after, &data) == Success && data) {
+                if (type == XA_WINDOW && items == 1) found = *(Window*)data;
+                XFree(data);
+            }
+        }
+        if (children) XFree(children);
+    }
+    return found;
+}
+
+// (Re)create the client-side image at the framebuffer size
+static int create_image(Host* host, int width, int height) {
+    if (host->image) {
+        XDestroyImage(host->image); // Also frees the pixel buffer
+        host->image = NULL;
+    }
+
+    host->width = width;
+    host->height = height;
+    int screen = DefaultScreen(host->display);
+    char* pixels = (char*)malloc((size_t)width * height * 4);
+    if (!pixels) return 0;
+
+    host->image = XCreateImage(host->display, DefaultVisual(host->display, screen),
+                               DefaultDepth(host->display, screen), ZPixmap, 0,
+                               pixels, width, height, 32, width * 4);
+    if (!host->image) {
+        free(pixels);
+        return 0;
+    }
+    return 1;
+}
+
+// (Re)create the engine and the image for the window size. Replayed frames
+// keep the recorder's size, the window shows what fits.
+static int resize_host(Host* host, int width, int height) {
+    if (host->replay) return 1;
+    pipes_init(host->pipes, width, height);
+    return create_image(host, width, height);
+}
+
+// Replay everything that has arrived, showing only the newest frame.
+// Returns 0 if the frame cannot be shown.
+static int replay_frames(Host* host, int* updated) {
+    if (!event_input_fill(&host->input)) return 0;
+
+    unsigned int used;
+    *updated = 0;
+    while ((used = pipes_replay(host->pipes, host->input.data, (unsigned int)host->input.size)) > 0) {
+        event_input_consume(&host->input, used);
+        *updated = 1;
+    }
+
+    int width = pipes_get_width(host->pipes);
+    int height = pipes_get_height(host->pipes);
+    if (*updated && (width != host->width || height != host->height)) {
+        return create_image(host, width, height);
+    }
+    return 1;
+}
+
+static void record_frame(Host* host) {
+    if (!host->recording) return;
+    if (!event_output_send(&host->output, pipes_get_events(host->pipes), pipes_get_event_size(host->pipes))) {
+        fprintf(stderr, "Event stream closed, recording stopped\n");
+        pipes_set_event_recording(host->pipes, 0);
+        event_output_close(&host->output);
+        host->recording = 0;
+        return;
+    }
+    pipes_clear_events(host->pipes);
+
+    // Restarting the recording logs a RESET of the scene as it is now, which
+    // only the displays that just connected get
+    if (event_output_accept(&host->output)) {
+        pipes_set_event_recording(host->pipes, 0);
+        pipes_set_event_recording(host->pipes, 1);
+        event_output_welcome(&host->output, pipes_get_events(host->pipes), pipes_get_event_size(host->pipes));
+        pipes_clear_events(host->pipes);
+    }
+}
+
+// The engine writes RGBA bytes; 24/32-bit TrueColor visuals want the red
+// channel in bits 16-23 of each little-endian pixel
+static void present(Host* host) {
+    TRACE_SCOPE("present");
+    const uint32_t* src = (const uint32_t*)pipes_get_framebuffer(host->pipes);
+    if (!src) return; // A replayed stream that has not started yet
+    uint32_t* dst = (uint32_t*)host->image->data;
+    int count = host->width * host->height;
+
+    for (int i = 0; i < count; i++) {
+        uint32_t p = src[i];
+        dst[i] = ((p & 0xFF) << 16) | (p & 0xFF00) | ((p >> 16) & 0xFF);
+    }
+
+    XPutImage(host->display, host->window, host->gc, host->image,
+              0, 0, 0, 0, host->width, host->height);
+    XFlush(host->display);
+}
+
+static void add_nanoseconds(struct timespec* t, long ns) {
+    t->tv_nsec += ns;
+    while (t->tv_nsec >= 1000000000L) {
+        t->tv_nsec -= 1000000000L;
+        t->tv_sec++;
+    }
+}
+
+int main(int argc, char** argv) {
+    Window target = 0;
+    int use_root = 0;
+    int fps = 60;
+    int width = 1280;
+    int height = 720;
+    const char* trace_path = NULL;
+    const char* record_path = NULL;
+    const char* replay_path = NULL;
+    int serve = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 < argc && (strcmp(argv[i], "-window-id") == 0 || strcmp(argv[i], "--window-id") == 0)) {
+            target = (Window)strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "-root") == 0 || strcmp(argv[i], "--root") == 0) {
+            use_root = 1;
+        } else if (i + 1 < argc && strcmp(argv[i], "-fps") == 0) {
+            fps = atoi(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "-geometry") == 0) {
+            sscanf(argv[++i], "%dx%d", &width, &height);
+        } else if (i + 1 < argc && strcmp(argv[i], "-trace") == 0) {
+            trace_path = argv[++i];
+        } else if (i + 1 < argc && (strcmp(argv[i], "-record") == 0 || strcmp(argv[i], "-serve") == 0)) {
+            serve = strcmp(argv[i], "-serve") == 0;
+            record_path = argv[++i];
+        } else if (i + 1 < argc && strcmp(argv[i], "-replay") == 0) {
+            replay_path = argv[++i];
+        } else if (strcmp(argv[i], "-window") == 0) {
+            // xscreensaver default mode, same as ours
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (fps < 1) fps = 1;
+    if (record_path && replay_path) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // xscreensaver hands over its window through the environment
+    const char* env_window = getenv("XSCREENSAVER_WINDOW");
+    if (!target && !use_root && env_window) {
+        target = (Window)strtoul(env_window, NULL, 0);
+    }
+
+    Host host = { 0 };
+    host.pipes = pipes_create();
+    if (!host.pipes) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    if (replay_path) {
+        if (!event_input_open(&host.input, replay_path)) {
+            fprintf(stderr, "Cannot open %s\n", replay_path);
+            return 1;
+        }
+        host.replay = 1;
+    } else if (record_path) {
+        if (!event_output_open(&host.output, record_path, serve)) {
+            fprintf(stderr, "Cannot open %s\n", record_path);
+            return 1;
+        }
+        host.recording = 1;
+        pipes_set_event_recording(host.pipes, 1);
+    }
+    host.display = XOpenDisplay(NULL);
+    if (!host.display) {
+        fprintf(stderr, "Cannot open X display\n");
+        return 1;
+    }
+
+    int screen = DefaultScreen(host.display);
+    Visual* visual = DefaultVisual(host.display, screen);
+    if (DefaultDepth(host.display, screen) < 24 || visual->red_mask != 0xFF0000) {
+        fprintf(stderr, "Unsupported visual, need 24-bit TrueColor\n");
+        XCloseDisplay(host.display);
+        return 1;
+    }
+
+    if (use_root) {
+        host.window = root_target(host.display, screen, env_window);
+    } else if (target) {
+        host.window = target;
+    } else {
+        host.window = XCreateSimpleWindow(host.display, RootWindow(host.display, screen),
+                                          0, 0, width, height, 0, 0, BlackPixel(host.display, screen));
+        XStoreName(host.display, host.window, "Pipes");
+        host.owns_window = 1;
+    }
+
+    // Foreign windows only get StructureNotify so we learn about resizes
+    XSelectInput(host.display, host.window,
+                 StructureNotifyMask | ExposureMask | (host.owns_window ? KeyPressMask : 0));
+    Atom wm_delete = XInternAtom(host.display, "WM_DELETE_WINDOW", False);
+    if (host.owns_window) {
+        XSetWMProtocols(host.display, host.window, &wm_delete, 1);
+        XMapWindow(host.display, host.window);
+    }
+
+    XWindowAttributes attributes;
+    XGetWindowAttributes(host.display, host.window, &attributes);
+    host.gc = XCreateGC(host.display, host.window, 0, NULL);
+    if (!resize_host(&host, attributes.width, attributes.height) ||
+        (host.replay && !create_image(&host, attributes.width, attributes.height))) {
+        fprintf(stderr, "Cannot allocate a %dx%d image\n", attributes.width, attributes.height);
+        return 1;
+    }
+
+    long frame_ns = 1000000000L / fps;
+    int idle_frames = fps > IDLE_FPS ? fps / IDLE_FPS : 1;
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+    int running = 1;
+    int repaint = 1; // The window needs the image even if the frame is unchanged
+    int due = 1;     // Frames of time the next tick covers
+    while (running) {
+        while (XPending(host.display)) {
+            XEvent event;
+            XNextEvent(host.display, &event);
+            switch (event.type) {
+                case ConfigureNotify:
+                    if (event.xconfigure.width != host.width || event.xconfigure.height != host.height) {
+                        if (!resize_host(&host, event.xconfigure.width, event.xconfigure.height)) {
+                            running = 0;
+                        }
+                        repaint = 1;
+                    }
+                    break;
+                case Expose:
+                    repaint = 1;
+                    break;
+                case DestroyNotify:
+                    running = 0;
+                    break;
+                case KeyPress:
+                    if (XLookupKeysym(&event.xkey, 0) == XK_Escape) running = 0;
+                    break;
+                case ClientMessage:
+                    if ((Atom)event.xclient.data.l[0] == wm_delete) running = 0;
+                    break;
+            }
+        }
+        if (!running) break;
+
+        int idle = 0;
+        if (host.replay) {
+            int updated;
+            if (!replay_frames(&host, &updated)) break;
+            if (updated || repaint) present(&host);
+        } else {
+            // Spawns are rolled once per frame, so an idle tick runs every
+            // frame it stood for. They cost next to nothing while black.
+            int changed = 0;
+            int state = 0;
+            for (int i = 0; i < due; i++) {
+                pipes_update(host.pipes);
+                record_frame(&host);
+                state = pipes_get_frame_state(host.pipes);
+                changed |= !(state & PIPES_FRAME_UNCHANGED);
+            }
+            if (changed || repaint) present(&host);
+            idle = !changed && (state & PIPES_FRAME_BLACK);
+        }
+        repaint = 0;
+        due = idle ? idle_frames : 1;
+
+        // Sleep to the next deadline; after a long stall start over from now
+        // instead of bursting frames to catch up
+        add_nanoseconds(&deadline, due * frame_ns);
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (now.tv_sec > deadline.tv_sec + 1) {
+            deadline = now;
+        }
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR) {
+        }
+    }
+
+    if (host.image) XDestroyImage(host.image);
+    XFreeGC(host.display, host.gc);
+    if (host.owns_window) XDestroyWindow(host.display, host.window);
+    XCloseDisplay(host.display);
+    pipes_destroy(host.pipes);
+    event_input_close(&host.input);
+    if (host.recording) event_output_close(&host.output);
+
+    if (trace_path && !trace_write(trace_path)) {
+        fprintf(stderr, "Cannot write trace to %s (needs a PIPES_TRACE build)\n", trace_path);
+    }
+    return 0;
+}
@@ -0,0 +1,62 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// One heap block that all buffers of an engine instance are carved from with
+// a bump pointer. Everything is released at once, and a reinit that fits in
+// the current block reuses it instead of going back to malloc, so resizing
+// does not fragment the WASM heap.
+
+#define ARENA_ALIGN 16 // Every carved buffer can be used with SIMD loads
+
+typedef struct {
+    void* block; // As returned by malloc
+    unsigned char* base; // block rounded up to ARENA_ALIGN
+    size_t capacity;
+    size_t used;
+} Arena;
+
+static inline size_t arena_align(size_t size) {
+    return (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+// Drop everything carved so far and make sure size bytes are available.
+// Returns 0, leaving the arena empty, if a larger block could not be allocated.
+static inline int arena_reset(Arena* a, size_t size) {
+    a->used = 0;
+    if (size <= a->capacity) return 1;
+
+    free(a->block);
+    a->block = malloc(size + ARENA_ALIGN - 1);
+    if (!a->block) {
+        a->base = NULL;
+        a->capacity = 0;
+        return 0;
+    }
+    a->base = (unsigned char*)(((uintptr_t)a->block + ARENA_ALIGN - 1) & ~(uintptr_t)(ARENA_ALIGN - 1));
+    a->capacity = size;
+    return 1;
+}
+
+// Carve size bytes, or NULL if the arena was reset for less than this
+static inline void* arena_alloc(Arena* a, size_t size) {
+    size = arena_align(size);
+    if (size > a->capacity - a->used) return NULL;
+
+    void* p = a->base + a->used;
+    a->used += size;
+    return p;
+}
+
+static inline void arena_destroy(Arena* a) {
+    free(a->block);
+    a->block = NULL;
+    a->base = NULL;
+    a->capacity = 0;
+    a->used = 0;
+}
+
+#endif
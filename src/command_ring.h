@@ -0,0 +1,65 @@
+#ifndef COMMAND_RING_H
+#define COMMAND_RING_H
+
+#include <stdint.h>
+
+// Single-producer/single-consumer command queue living in WASM memory.
+// JavaScript fills a slot and publishes it by advancing head; the engine
+// drains everything up to head once per frame and advances tail. Neither
+// side takes a lock, so the producer may be the main thread while the engine
+// runs in a worker. Layout must match src/lib/commandRing.js.
+
+#define COMMAND_RING_CAPACITY 256 // Must be a power of two
+
+typedef enum {
+    CMD_NONE = 0,
+    CMD_MOUSE_DOWN = 1,
+    CMD_MOUSE_UP = 2,
+    CMD_MOUSE_MOVE = 3,
+    CMD_SET_FADE_SPEED = 4,
+    CMD_SET_SPAWN_RATE = 5,
+    CMD_SET_TURN_PROBABILITY = 6,
+    CMD_SET_MAX_PIPES = 7,
+    CMD_SET_ANIMATION_SPEED = 8,
+    CMD_SET_CAMERA_SPEED = 9,
+    CMD_SET_PIPE_SPEED = 10,
+    CMD_SET_SEGMENT_DELAY = 11,
+    CMD_SET_RENDER_SCALE = 12,
+    CMD_SET_AUTO_RENDER_SCALE = 13,
+    CMD_SET_STEPS_PER_FRAME = 14
+} CommandType;
+
+typedef struct {
+    int32_t type;
+    int32_t a;
+    int32_t b;
+    float f;
+} Command;
+
+typedef struct {
+    uint32_t head; // Written by the producer only
+    uint32_t tail; // Written by the engine only
+    uint32_t capacity;
+    uint32_t reserved;
+    Command slots[COMMAND_RING_CAPACITY];
+} CommandRing;
+
+static inline void command_ring_init(CommandRing* ring) {
+    ring->head = 0;
+    ring->tail = 0;
+    ring->capacity = COMMAND_RING_CAPACITY;
+    ring->reserved = 0;
+}
+
+// Returns 1 and fills cmd if a command was pending, 0 once the ring is empty
+static inline int command_ring_pop(CommandRing* ring, Command* cmd) {
+    uint32_t tail = ring->tail;
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    if (tail == head) return 0;
+
+    *cmd = ring->slots[tail & (COMMAND_RING_CAPACITY - 1)];
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+#endif
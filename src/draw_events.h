@@ -0,0 +1,166 @@
+#ifndef DRAW_EVENTS_H
+#define DRAW_EVENTS_H
+
+#include <stdlib.h>
+
+// Compact log of what an engine draws, so that one authoritative simulation
+// can drive any number of displays without shipping pixels. While recording,
+// an engine appends an event for every spawn, segment, elbow and death; a
+// display hands the bytes to the same engine's replay function, which draws
+// the same pipes without simulating anything.
+//
+// Each event is one byte with the type in the high nibble and a small
+// argument, usually a direction, in the low one, followed by a fixed number
+// of unsigned LEB128 varints. A segment of a pipe below index 128 takes two
+// bytes. FRAME closes each displayed frame and there is no other framing,
+// so a stream can go through a pipe, a socket or a growing file; a reader
+// replays whole frames and waits for more bytes when the next is partial.
+//
+//   RESET    arg engine, varint count, count engine-specific values
+//   FRAME    varint fade                      present, after fading by fade
+//   STEP     a simulation step ended, for engines that animate between steps
+//   SPAWN    arg direction, varint pipe, x, y, z, color
+//   SEGMENT  arg direction, varint pipe       pipe moves one cell that way
+//   ELBOW    arg new direction, varint pipe
+//   DIE      varint pipe
+//   CLEAR    the engine recycled its grid
+//   CELL     arg engine-specific kind, varint x, y, z, color
+//   PARAM    arg parameter, varint value
+//
+// Coordinates, directions and colors are those of the engine named by the
+// last RESET. Engines emit a RESET followed by the state of their live pipes
+// whenever recording starts or the scene restarts, so displays can join a
+// stream at any RESET.
+
+#define DRAW_EVENT_RESET 0
+#define DRAW_EVENT_FRAME 1
+#define DRAW_EVENT_STEP 2
+#define DRAW_EVENT_SPAWN 3
+#define DRAW_EVENT_SEGMENT 4
+#define DRAW_EVENT_ELBOW 5
+#define DRAW_EVENT_DIE 6
+#define DRAW_EVENT_CLEAR 7
+#define DRAW_EVENT_CELL 8
+#define DRAW_EVENT_PARAM 9
+#define DRAW_EVENT_TYPES 10
+
+// Engines, the argument of RESET
+#define DRAW_EVENTS_SOFTWARE 1 // src/pipes.c
+#define DRAW_EVENTS_FLAT 2     // src/pipes_2d_raylib.c
+#define DRAW_EVENTS_3D 3       // src/pipes_3d.c
+
+#define DRAW_EVENT_MAX_VALUES 8
+
+typedef struct {
+    unsigned char* data;
+    size_t size;
+    size_t capacity;
+    int failed; // An allocation failed and events were dropped
+} DrawEventLog;
+
+typedef struct {
+    int type;
+    int arg;
+    int count;
+    unsigned int values[DRAW_EVENT_MAX_VALUES];
+} DrawEvent;
+
+// Values following each type, -1 for RESET's counted list
+static const signed char draw_event_values[DRAW_EVENT_TYPES] = { -1, 1, 0, 5, 1, 1, 1, 0, 4, 1 };
+
+static inline void draw_events_free(DrawEventLog* log) {
+    free(log->data);
+    *log = (DrawEventLog){ 0 };
+}
+
+// Drop the events that were read, keeping the allocation
+static inline void draw_events_clear(DrawEventLog* log) {
+    log->size = 0;
+}
+
+static inline void draw_events_put(DrawEventLog* log, int type, int arg, int count, const unsigned int* values) {
+    // Opcode, a count and up to eight five-byte varints
+    size_t needed = log->size + 2 + DRAW_EVENT_MAX_VALUES * 5;
+    if (needed > log->capacity) {
+        size_t capacity = log->capacity ? log->capacity * 2 : 4096;
+        while (capacity < needed) capacity *= 2;
+        unsigned char* data = (unsigned char*)realloc(log->data, capacity);
+        if (!data) {
+            log->failed = 1;
+            return;
+        }
+        log->data = data;
+        log->capacity = capacity;
+    }
+
+    log->data[log->size++] = (unsigned char)(type << 4 | (arg & 15));
+    if (draw_event_values[type] < 0) log->data[log->size++] = (unsigned char)count;
+    for (int i = 0; i < count; i++) {
+        unsigned int v = values[i];
+        while (v >= 0x80) {
+            log->data[log->size++] = (unsigned char)(v | 0x80);
+            v >>= 7;
+        }
+        log->data[log->size++] = (unsigned char)v;
+    }
+}
+
+static inline void draw_events_pipe(DrawEventLog* log, int type, int arg, int pipe) {
+    unsigned int value = (unsigned int)pipe;
+    draw_events_put(log, type, arg, 1, &value);
+}
+
+static inline void draw_events_spawn(DrawEventLog* log, int pipe, int dir, int x, int y, int z, int color) {
+    unsigned int values[5] = { (unsigned int)pipe, (unsigned int)x, (unsigned int)y, (unsigned int)z, (unsigned int)color };
+    draw_events_put(log, DRAW_EVENT_SPAWN, dir, 5, values);
+}
+
+// Decode the event at data[*pos] and advance past it. Returns 0, leaving
+// *pos alone, if the event is not complete yet, and -1 for bytes that cannot
+// be an event; the caller may skip one byte and carry on.
+static inline int draw_events_next(const unsigned char* data, size_t size, size_t* pos, DrawEvent* event) {
+    size_t p = *pos;
+    if (p >= size) return 0;
+
+    event->type = data[p] >> 4;
+    event->arg = data[p] & 15;
+    p++;
+    if (event->type >= DRAW_EVENT_TYPES) return -1;
+
+    event->count = draw_event_values[event->type];
+    if (event->count < 0) {
+        if (p >= size) return 0;
+        event->count = data[p++];
+        if (event->count > DRAW_EVENT_MAX_VALUES) return -1;
+    }
+
+    for (int i = 0; i < event->count; i++) {
+        unsigned int v = 0;
+        for (int shift = 0;; shift += 7) {
+            if (shift > 28) return -1;
+            if (p >= size) return 0;
+            unsigned char b = data[p++];
+            v |= (unsigned int)(b & 0x7F) << shift;
+            if (!(b & 0x80)) break;
+        }
+        event->values[i] = v;
+    }
+    *pos = p;
+    return 1;
+}
+
+// Bytes up to and including the first FRAME in data, which the caller can
+// replay as one frame, or 0 if no frame is complete yet. The FRAME itself
+// goes to *frame.
+static inline size_t draw_events_frame_size(const unsigned char* data, size_t size, DrawEvent* frame) {
+    size_t pos = 0;
+    for (;;) {
+        size_t start = pos;
+        int result = draw_events_next(data, size, &pos, frame);
+        if (result == 0) return 0;
+        if (result < 0) pos = start + 1; // Not an event, resynchronize on the next byte
+        else if (frame->type == DRAW_EVENT_FRAME) return pos;
+    }
+}
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef FREE_CELLS_H
+#define FREE_CELLS_H
+
+#include <stdlib.h>
+
+// Index of the free cells of a grid, kept as a dense swap-remove list so that
+// claiming, releasing and picking a uniformly random free cell are all O(1)
+// no matter how full the grid is. Cells are identified by their flat index.
+
+typedef struct {
+    int* cells; // Free cell indices, first count entries are valid
+    int* slots; // Position of each cell in cells, -1 while claimed
+    int count;
+    int total;
+} FreeCells;
+
+// Returns 0 if the index could not be allocated
+static inline int free_cells_init(FreeCells* f, int total) {
+    f->cells = (int*)malloc(total * sizeof(int));
+    f->slots = (int*)malloc(total * sizeof(int));
+    f->total = total;
+    f->count = 0;
+    if (!f->cells || !f->slots) {
+        free(f->cells);
+        free(f->slots);
+        f->cells = NULL;
+        f->slots = NULL;
+        f->total = 0;
+        return 0;
+    }
+    return 1;
+}
+
+// Bytes of caller-provided storage free_cells_attach() needs for total cells
+static inline size_t free_cells_bytes(int total) {
+    return (size_t)total * 2 * sizeof(int);
+}
+
+// Use storage of free_cells_bytes(total) instead of allocating. An attached
+// index is released with its storage, never with free_cells_destroy().
+static inline void free_cells_attach(FreeCells* f, int total, void* storage) {
+    f->cells = (int*)storage;
+    f->slots = f->cells + total;
+    f->total = total;
+    f->count = 0;
+}
+
+static inline void free_cells_destroy(FreeCells* f) {
+    free(f->cells);
+    free(f->slots);
+    f->cells = NULL;
+    f->slots = NULL;
+    f->count = 0;
+    f->total = 0;
+}
+
+// Mark every cell free
+static inline void free_cells_reset(FreeCells* f) {
+    for (int i = 0; i < f->total; i++) {
+        f->cells[i] = i;
+        f->slots[i] = i;
+    }
+    f->count = f->total;
+}
+
+static inline void free_cells_claim(FreeCells* f, int cell) {
+    int slot = f->slots[cell];
+    if (slot < 0) return;
+
+    int last = f->cells[--f->count];
+    f->cells[slot] = last;
+    f->slots[last] = slot;
+    f->slots[cell] = -1;
+}
+
+static inline void free_cells_release(FreeCells* f, int cell) {
+    if (f->slots[cell] >= 0) return;
+
+    f->cells[f->count] = cell;
+    f->slots[cell] = f->count++;
+}
+
+// Uniformly random free cell for the random value r, or -1 if none are left
+static inline int free_cells_pick(const FreeCells* f, unsigned int r) {
+    return f->count > 0 ? f->cells[r % f->count] : -1;
+}
+
+static inline int free_cells_occupancy_percent(const FreeCells* f) {
+    return f->total > 0 ? (int)((long long)(f->total - f->count) * 100 / f->total) : 100;
+}
+
+#endif
@@ -0,0 +1,67 @@
+// JavaScript producer for the engine command ring (see src/command_ring.h).
+// Commands are written straight into WASM memory and picked up by the engine
+// at the start of its next frame, so UI events never call into WASM.
+
+export const Cmd = {
+  MOUSE_DOWN: 1,
+  MOUSE_UP: 2,
+  MOUSE_MOVE: 3,
+  SET_FADE_SPEED: 4,
+  SET_SPAWN_RATE: 5,
+  SET_TURN_PROBABILITY: 6,
+  SET_MAX_PIPES: 7,
+  SET_ANIMATION_SPEED: 8,
+  SET_CAMERA_SPEED: 9,
+  SET_PIPE_SPEED: 10,
+  SET_SEGMENT_DELAY: 11,
+  SET_RENDER_SCALE: 12,
+  SET_AUTO_RENDER_SCALE: 13,
+  SET_STEPS_PER_FRAME: 14
+};
+
+const HEADER_WORDS = 4;
+const SLOT_WORDS = 4;
+
+export class CommandRing {
+  // getBuffer returns the current WASM memory buffer. It is called on every
+  // push because memory growth replaces the buffer; in a worker setup it can
+  // return the SharedArrayBuffer handed over by the worker.
+  constructor(getBuffer, ptr) {
+    this.getBuffer = getBuffer;
+    this.base = ptr >> 2;
+    this.buffer = null;
+    this.refreshViews();
+    this.capacity = this.i32[this.base + 2];
+  }
+
+  refreshViews() {
+    const buffer = this.getBuffer();
+    if (buffer === this.buffer) return;
+    this.buffer = buffer;
+    this.i32 = new Int32Array(buffer);
+    this.f32 = new Float32Array(buffer);
+    this.shared = typeof SharedArrayBuffer !== 'undefined' && buffer instanceof SharedArrayBuffer;
+  }
+
+  // Returns false if the engine has fallen a full ring behind
+  push(type, a = 0, b = 0, f = 0) {
+    this.refreshViews();
+    const i32 = this.i32;
+    const head = this.shared ? Atomics.load(i32, this.base) : i32[this.base];
+    const tail = this.shared ? Atomics.load(i32, this.base + 1) : i32[this.base + 1];
+    if (((head - tail) >>> 0) >= this.capacity) return false;
+
+    const slot = this.base + HEADER_WORDS + (head & (this.capacity - 1)) * SLOT_WORDS;
+    i32[slot] = type;
+    i32[slot + 1] = a;
+    i32[slot + 2] = b;
+    this.f32[slot + 3] = f;
+
+    if (this.shared) {
+      Atomics.store(i32, this.base, (head + 1) | 0);
+    } else {
+      i32[this.base] = (head + 1) | 0;
+    }
+    return true;
+  }
+}
@@ -0,0 +1,169 @@
+// WebGL2 presenter for the software engine's dirty presentation mode (see
+// PIPES_PRESENT_DIRTY in src/pipes.h). The image is kept on the GPU in a
+// pair of textures: every frame a fragment shader fades the previous image
+// into the other texture and lays the frame's new pixels on top, so the CPU
+// only uploads the tiles the pipes actually drew to.
+
+const TILE_SIZE = 64; // PIPES_TILE_SIZE in src/pipes.h
+
+// Full-screen triangle generated from the vertex index, no buffers needed
+const VERTEX_SHADER = `#version 300 es
+void main() {
+  vec2 corner = vec2(float((gl_VertexID << 1) & 2), float(gl_VertexID & 2));
+  gl_Position = vec4(corner * 2.0 - 1.0, 0.0, 1.0);
+}`;
+
+// Same result as the engine's saturating CPU fade: RGBA8 stores multiples of
+// 1/255, so subtracting fade / 255 lands on the same byte
+const FADE_SHADER = `#version 300 es
+precision highp float;
+uniform sampler2D previous;
+uniform sampler2D stamps;
+uniform float fade;
+out vec4 color;
+void main() {
+  ivec2 texel = ivec2(gl_FragCoord.xy);
+  vec4 stamp = texelFetch(stamps, texel, 0);
+  vec3 faded = max(texelFetch(previous, texel, 0).rgb - fade, 0.0);
+  color = vec4(stamp.a > 0.5 ? stamp.rgb : faded, 1.0);
+}`;
+
+function compile(gl, type, source) {
+  const shader = gl.createShader(type);
+  gl.shaderSource(shader, source);
+  gl.compileShader(shader);
+  if (!gl.getShaderParameter(shader, gl.COMPILE_STATUS)) {
+    throw new Error(gl.getShaderInfoLog(shader));
+  }
+  return shader;
+}
+
+export class FadeRenderer {
+  // Returns null if the canvas cannot get a WebGL2 context
+  static create(canvas) {
+    const gl = canvas.getContext('webgl2', { alpha: false, antialias: false, depth: false, stencil: false });
+    if (!gl) return null;
+    try {
+      return new FadeRenderer(gl);
+    } catch (error) {
+      console.warn('WebGL2 fade unavailable:', error);
+      return null;
+    }
+  }
+
+  constructor(gl) {
+    this.gl = gl;
+    this.width = 0;
+    this.height = 0;
+    this.textures = [];
+
+    const program = gl.createProgram();
+    gl.attachShader(program, compile(gl, gl.VERTEX_SHADER, VERTEX_SHADER));
+    gl.attachShader(program, compile(gl, gl.FRAGMENT_SHADER, FADE_SHADER));
+    gl.linkProgram(program);
+    if (!gl.getProgramParameter(program, gl.LINK_STATUS)) {
+      throw new Error(gl.getProgramInfoLog(program));
+    }
+    this.program = program;
+    this.fadeLocation = gl.getUniformLocation(program, 'fade');
+    gl.useProgram(program);
+    gl.uniform1i(gl.getUniformLocation(program, 'previous'), 0);
+    gl.uniform1i(gl.getUniformLocation(program, 'stamps'), 1);
+
+    // Ping-pong images, each with a framebuffer to render into, and the
+    // texture the new pixels are uploaded to
+    this.images = [0, 1].map(() => ({ texture: null, framebuffer: gl.createFramebuffer() }));
+    this.stamps = { texture: null, framebuffer: gl.createFramebuffer() };
+    this.current = 0;
+    this.vertexArray = gl.createVertexArray();
+  }
+
+  createTarget(target) {
+    const gl = this.gl;
+    if (target.texture) gl.deleteTexture(target.texture);
+    target.texture = gl.createTexture();
+    gl.bindTexture(gl.TEXTURE_2D, target.texture);
+    gl.texStorage2D(gl.TEXTURE_2D, 1, gl.RGBA8, this.width, this.height);
+    gl.texParameteri(gl.TEXTURE_2D, gl.TEXTURE_MIN_FILTER, gl.NEAREST);
+    gl.texParameteri(gl.TEXTURE_2D, gl.TEXTURE_MAG_FILTER, gl.NEAREST);
+    gl.bindFramebuffer(gl.FRAMEBUFFER, target.framebuffer);
+    gl.framebufferTexture2D(gl.FRAMEBUFFER, gl.COLOR_ATTACHMENT0, gl.TEXTURE_2D, target.texture, 0);
+    gl.clearColor(0, 0, 0, 0);
+    gl.clear(gl.COLOR_BUFFER_BIT);
+  }
+
+  // Start over with a black image, after pipes_init() at this size
+  resize(width, height) {
+    this.width = width;
+    this.height = height;
+    this.images.forEach((image) => this.createTarget(image));
+    this.createTarget(this.stamps);
+    this.gl.bindFramebuffer(this.gl.FRAMEBUFFER, null);
+  }
+
+  // heap is HEAPU8 of the engine's module, the pointers and counts come from
+  // pipes_get_framebuffer(), pipes_get_dirty_tiles(),
+  // pipes_get_dirty_tile_count() and pipes_get_frame_fade()
+  present(heap, framebufferPtr, tilesPtr, tileCount, fade) {
+    if (tileCount === 0 && fade === 0) return; // The canvas keeps the last frame
+    const gl = this.gl;
+    const { width, height } = this;
+
+    // Only this frame's pixels may be opaque in the stamp texture
+    gl.bindFramebuffer(gl.FRAMEBUFFER, this.stamps.framebuffer);
+    gl.clear(gl.COLOR_BUFFER_BIT);
+
+    // Upload the dirty tiles, one call per run of neighbors in a tile row
+    gl.bindTexture(gl.TEXTURE_2D, this.stamps.texture);
+    gl.pixelStorei(gl.UNPACK_ROW_LENGTH, width);
+    const tilesX = Math.ceil(width / TILE_SIZE);
+    const tiles = new Int32Array(heap.buffer, tilesPtr, tileCount);
+    for (let i = 0; i < tileCount;) {
+      const first = tiles[i];
+      let last = first;
+      while (++i < tileCount && tiles[i] === last + 1 && tiles[i] % tilesX !== 0) last = tiles[i];
+
+      const x = (first % tilesX) * TILE_SIZE;
+      const y = Math.floor(first / tilesX) * TILE_SIZE;
+      const runWidth = Math.min((last - first + 1) * TILE_SIZE, width - x);
+      const runHeight = Math.min(TILE_SIZE, height - y);
+      gl.texSubImage2D(gl.TEXTURE_2D, 0, x, y, runWidth, runHeight, gl.RGBA, gl.UNSIGNED_BYTE,
+                       heap, framebufferPtr + (y * width + x) * 4);
+    }
+    gl.pixelStorei(gl.UNPACK_ROW_LENGTH, 0);
+
+    // Fade the previous image into the other one, stamps on top
+    const source = this.images[this.current];
+    const target = this.images[1 - this.current];
+    gl.bindFramebuffer(gl.FRAMEBUFFER, target.framebuffer);
+    gl.viewport(0, 0, width, height);
+    gl.useProgram(this.program);
+    gl.uniform1f(this.fadeLocation, fade / 255);
+    gl.activeTexture(gl.TEXTURE0);
+    gl.bindTexture(gl.TEXTURE_2D, source.texture);
+    gl.activeTexture(gl.TEXTURE1);
+    gl.bindTexture(gl.TEXTURE_2D, this.stamps.texture);
+    gl.bindVertexArray(this.vertexArray);
+    gl.drawArrays(gl.TRIANGLES, 0, 3);
+    gl.activeTexture(gl.TEXTURE0);
+    this.current = 1 - this.current;
+
+    // Row 0 of the images is the top of the screen, so flip on the way out
+    gl.bindFramebuffer(gl.READ_FRAMEBUFFER, target.framebuffer);
+    gl.bindFramebuffer(gl.DRAW_FRAMEBUFFER, null);
+    gl.blitFramebuffer(0, 0, width, height, 0, height, width, 0, gl.COLOR_BUFFER_BIT, gl.NEAREST);
+    gl.bindFramebuffer(gl.FRAMEBUFFER, null);
+  }
+
+  // Copy the current image, top row first like the engine's framebuffer,
+  // into pixels (width * height * 4 bytes). Stalls until the GPU is done, so
+  // only for snapshots. Returns false before the first resize().
+  readImage(pixels) {
+    if (this.width === 0 || this.height === 0) return false;
+    const gl = this.gl;
+    gl.bindFramebuffer(gl.FRAMEBUFFER, this.images[this.current].framebuffer);
+    gl.readPixels(0, 0, this.width, this.height, gl.RGBA, gl.UNSIGNED_BYTE, pixels);
+    gl.bindFramebuffer(gl.FRAMEBUFFER, null);
+    return true;
+  }
+}
@@ -0,0 +1,81 @@
+// Scene snapshots (see pipes_snapshot() in src/pipes.c and pipes3d_snapshot()
+// in src/pipes_3d.c) persisted in IndexedDB, so a reloaded page starts from
+// the scene it was showing instead of an empty screen.
+
+const DB_NAME = 'pipes';
+const STORE_NAME = 'snapshots';
+
+let dbPromise = null;
+
+function openDb() {
+  if (!dbPromise) {
+    dbPromise = new Promise((resolve, reject) => {
+      const request = indexedDB.open(DB_NAME, 1);
+      request.onupgradeneeded = () => request.result.createObjectStore(STORE_NAME);
+      request.onsuccess = () => resolve(request.result);
+      request.onerror = () => reject(request.error);
+    });
+    dbPromise.catch(() => { dbPromise = null; });
+  }
+  return dbPromise;
+}
+
+function run(mode, operation) {
+  return openDb().then((db) => new Promise((resolve, reject) => {
+    const request = operation(db.transaction(STORE_NAME, mode).objectStore(STORE_NAME));
+    request.onsuccess = () => resolve(request.result);
+    request.onerror = () => reject(request.error);
+  }));
+}
+
+export function storeSnapshot(key, bytes) {
+  return run('readwrite', (store) => store.put(bytes, key));
+}
+
+// Resolves to the stored bytes, or null if there are none or storage is unavailable
+export function loadSnapshot(key) {
+  return run('readonly', (store) => store.get(key))
+    .then((bytes) => bytes || null)
+    .catch(() => null);
+}
+
+// Moves snapshots between JS and an engine through one reusable buffer in
+// WASM memory. maxSize() returns the current upper bound on a snapshot.
+export class SnapshotBuffer {
+  constructor(module, maxSize) {
+    this.module = module;
+    this.maxSize = maxSize;
+    this.ptr = 0;
+    this.size = 0;
+  }
+
+  reserve(size) {
+    if (size > this.size) {
+      if (this.ptr) this.module._free(this.ptr);
+      this.ptr = this.module._malloc(size);
+      this.size = this.ptr ? size : 0;
+    }
+    return this.ptr;
+  }
+
+  // write(ptr, size) serializes into the buffer and returns the bytes written
+  capture(write) {
+    const ptr = this.reserve(this.maxSize());
+    const length = ptr ? write(ptr, this.size) : 0;
+    return length ? this.module.HEAPU8.slice(ptr, ptr + length) : null;
+  }
+
+  // read(ptr, length) deserializes from the buffer and returns nonzero on success
+  restore(bytes, read) {
+    const ptr = this.reserve(bytes.length);
+    if (!ptr) return false;
+    this.module.HEAPU8.set(bytes, ptr);
+    return read(ptr, bytes.length) !== 0;
+  }
+
+  release() {
+    if (this.ptr) this.module._free(this.ptr);
+    this.ptr = 0;
+    this.size = 0;
+  }
+}
@@ -0,0 +1,58 @@
+// Runtime detection of the WebAssembly features our build variants rely on
+// (see build-wasm.sh), used to load the fastest variant the browser can run.
+
+// Smallest module using a v128 instruction; only validates with SIMD support
+const SIMD_PROBE = new Uint8Array([
+  0, 97, 115, 109, 1, 0, 0, 0, 1, 5, 1, 96, 0, 1, 123, 3, 2, 1, 0, 10, 10, 1, 8, 0, 65, 0, 253, 15, 253, 98, 11
+]);
+
+export function supportsSimd() {
+  try {
+    return WebAssembly.validate(SIMD_PROBE);
+  } catch {
+    return false;
+  }
+}
+
+// Variant names in preference order, restricted to what this browser supports
+export function preferredVariants(available) {
+  const simd = supportsSimd();
+  return available.filter((variant) => {
+    if (variant === 'simd') return simd;
+    return true;
+  });
+}
+
+// Import the first variant that loads, falling back to the next one when a
+// variant is missing from the build. loaders maps variant name to import().
+export async function importBestVariant(loaders) {
+  let lastError;
+  for (const variant of preferredVariants(Object.keys(loaders))) {
+    try {
+      const module = await loaders[variant]();
+      console.log(`Using ${variant} WASM variant`);
+      return module;
+    } catch (error) {
+      lastError = error;
+      console.warn(`WASM variant ${variant} unavailable:`, error);
+    }
+  }
+  throw lastError;
+}
+
+// Instantiate an Emscripten MODULARIZE factory with the .wasm compiled while
+// it downloads. The glue would otherwise look the binary up relative to its
+// own URL; handing it over here keeps the fetch under our control and lets a
+// failed compile reject the returned promise instead of aborting.
+export function createModuleStreaming(factory, wasmUrl) {
+  return new Promise((resolve, reject) => {
+    factory({
+      instantiateWasm(imports, receiveInstance) {
+        WebAssembly.instantiateStreaming(fetch(wasmUrl), imports)
+          .then(({ instance, module }) => receiveInstance(instance, module))
+          .catch(reject);
+        return {}; // Exports arrive asynchronously through receiveInstance
+      }
+    }).then(resolve, reject);
+  });
+}
@@ -0,0 +1,160 @@
+#ifndef NEIGHBOR_GRID_H
+#define NEIGHBOR_GRID_H
+
+// Occupancy grid that also tracks, for every cell, which of its six
+// neighbors are free. Claiming a cell clears the matching bit in each
+// neighbor, so a turn only needs the mask of the cell a pipe is in instead
+// of six coordinate conversions and lookups.
+//
+// Each cell is one byte: NEIGHBOR_OCCUPIED plus one bit per direction whose
+// neighbor is inside the grid and unclaimed. Cells are indexed
+// (x * ny + y) * nz + z. Directions are engine-specific steps, but must come
+// in opposite pairs so that d ^ 1 is the reverse of d.
+
+#define NEIGHBOR_DIRECTIONS 6
+#define NEIGHBOR_OCCUPIED 0x80
+#define NEIGHBOR_FREE_MASK 0x3F
+
+typedef struct {
+    unsigned char* cells;
+    int nx, ny, nz;
+    int offsets[NEIGHBOR_DIRECTIONS]; // Index delta to the neighbor in each direction
+    signed char steps[NEIGHBOR_DIRECTIONS][3];
+} NeighborGrid;
+
+static inline int neighbor_grid_index(const NeighborGrid* g, int x, int y, int z) {
+    return (x * g->ny + y) * g->nz + z;
+}
+
+static inline void neighbor_grid_attach(NeighborGrid* g, unsigned char* cells, int nx, int ny, int nz,
+                                        const signed char steps[NEIGHBOR_DIRECTIONS][3]) {
+    g->cells = cells;
+    g->nx = nx;
+    g->ny = ny;
+    g->nz = nz;
+    for (int d = 0; d < NEIGHBOR_DIRECTIONS; d++) {
+        for (int axis = 0; axis < 3; axis++) g->steps[d][axis] = steps[d][axis];
+        g->offsets[d] = (steps[d][0] * ny + steps[d][1]) * nz + steps[d][2];
+    }
+}
+
+// Directions whose neighbor lies inside the grid
+static inline unsigned int neighbor_grid_inside(const NeighborGrid* g, int x, int y, int z) {
+    unsigned int mask = 0;
+    for (int d = 0; d < NEIGHBOR_DIRECTIONS; d++) {
+        int nx = x + g->steps[d][0];
+        int ny = y + g->steps[d][1];
+        int nz = z + g->steps[d][2];
+        if (nx >= 0 && nx < g->nx && ny >= 0 && ny < g->ny && nz >= 0 && nz < g->nz) {
+            mask |= 1u << d;
+        }
+    }
+    return mask;
+}
+
+static inline int neighbor_grid_occupied(const NeighborGrid* g, int cell) {
+    return (g->cells[cell] & NEIGHBOR_OCCUPIED) != 0;
+}
+
+// Free neighbors of a cell, one bit per direction
+static inline unsigned int neighbor_grid_free(const NeighborGrid* g, int cell) {
+    return g->cells[cell] & NEIGHBOR_FREE_MASK;
+}
+
+static inline void neighbor_grid_claim(NeighborGrid* g, int x, int y, int z) {
+    int cell = neighbor_grid_index(g, x, y, z);
+    if (g->cells[cell] & NEIGHBOR_OCCUPIED) return;
+
+    g->cells[cell] |= NEIGHBOR_OCCUPIED;
+    unsigned int inside = neighbor_grid_inside(g, x, y, z);
+    for (int d = 0; d < NEIGHBOR_DIRECTIONS; d++) {
+        if (inside & (1u << d)) {
+            g->cells[cell + g->offsets[d]] &= (unsigned char)~(1u << (d ^ 1));
+        }
+    }
+}
+
+// neighbor_grid_claim() for threads claiming concurrently. Claims only set
+// and clear bits, so the grid ends up the same whatever order they land in.
+static inline void neighbor_grid_claim_atomic(NeighborGrid* g, int x, int y, int z) {
+    int cell = neighbor_grid_index(g, x, y, z);
+    if (__atomic_fetch_or(&g->cells[cell], NEIGHBOR_OCCUPIED, __ATOMIC_RELAXED) & NEIGHBOR_OCCUPIED) return;
+
+    unsigned int inside = neighbor_grid_inside(g, x, y, z);
+    for (int d = 0; d < NEIGHBOR_DIRECTIONS; d++) {
+        if (inside & (1u << d)) {
+            __atomic_fetch_and(&g->cells[cell + g->offsets[d]], (unsigned char)~(1u << (d ^ 1)), __ATOMIC_RELAXED);
+        }
+    }
+}
+
+// Recompute every mask from plain occupancy, any nonzero byte being a
+// claimed cell. Used after clearing the grid or loading it from a snapshot.
+static inline void neighbor_grid_rebuild(NeighborGrid* g) {
+    for (int x = 0; x < g->nx; x++) {
+        for (int y = 0; y < g->ny; y++) {
+            for (int z = 0; z < g->nz; z++) {
+                int cell = neighbor_grid_index(g, x, y, z);
+                g->cells[cell] = (unsigned char)((g->cells[cell] ? NEIGHBOR_OCCUPIED : 0) |
+                                                 neighbor_grid_inside(g, x, y, z));
+            }
+        }
+    }
+    for (int x = 0; x < g->nx; x++) {
+        for (int y = 0; y < g->ny; y++) {
+            for (int z = 0; z < g->nz; z++) {
+                int cell = neighbor_grid_index(g, x, y, z);
+                if (!(g->cells[cell] & NEIGHBOR_OCCUPIED)) continue;
+                unsigned int inside = neighbor_grid_inside(g, x, y, z);
+                for (int d = 0; d < NEIGHBOR_DIRECTIONS; d++) {
+                    if (inside & (1u << d)) {
+                        g->cells[cell + g->offsets[d]] &= (unsigned char)~(1u << (d ^ 1));
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Of the directions in mask, prefer those leading to a cell that still has a
+// free neighbor of its own, so pipes do not turn into dead ends
+static inline unsigned int neighbor_grid_avoid_dead_ends(const NeighborGrid* g, int cell, unsigned int mask) {
+    unsigned int open = 0;
+    for (int d = 0; d < NEIGHBOR_DIRECTIONS; d++) {
+        if ((mask & (1u << d)) && neighbor_grid_free(g, cell + g->offsets[d])) {
+            open |= 1u << d;
+        }
+    }
+    return open ? open : mask;
+}
+
+// The set directions of every 6-bit mask: bits 0-2 hold the count and each
+// following 3-bit field one direction, lowest first
+static const unsigned int neighbor_choices[64] = {
+    0x000000, 0x000001, 0x000009, 0x000042,
+    0x000011, 0x000082, 0x00008A, 0x000443,
+    0x000019, 0x0000C2, 0x0000CA, 0x000643,
+    0x0000D2, 0x000683, 0x00068B, 0x003444,
+    0x000021, 0x000102, 0x00010A, 0x000843,
+    0x000112, 0x000883, 0x00088B, 0x004444,
+    0x00011A, 0x0008C3, 0x0008CB, 0x004644,
+    0x0008D3, 0x004684, 0x00468C, 0x023445,
+    0x000029, 0x000142, 0x00014A, 0x000A43,
+    0x000152, 0x000A83, 0x000A8B, 0x005444,
+    0x00015A, 0x000AC3, 0x000ACB, 0x005644,
+    0x000AD3, 0x005684, 0x00568C, 0x02B445,
+    0x000162, 0x000B03, 0x000B0B, 0x005844,
+    0x000B13, 0x005884, 0x00588C, 0x02C445,
+    0x000B1B, 0x0058C4, 0x0058CC, 0x02C645,
+    0x0058D4, 0x02C685, 0x02C68D, 0x163446,
+};
+
+// Uniformly random direction from mask for the random value r, or -1 if empty
+static inline int neighbor_pick(unsigned int mask, unsigned int r) {
+    unsigned int choices = neighbor_choices[mask & NEIGHBOR_FREE_MASK];
+    unsigned int count = choices & 7;
+    if (count == 0) return -1;
+    return (int)((choices >> (3 + 3 * (r % count))) & 7);
+}
+
+#endif
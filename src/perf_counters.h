@@ -0,0 +1,124 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+// Linux hardware performance counters (perf_event_open) for the native
+// benchmark and, in PIPES_TRACE builds, for every traced phase (see
+// trace_counters_enable() in src/trace.h). Counts the calling thread in user
+// space only. Counters the CPU, VM or container does not offer are left out;
+// when none are, perf_counters_open() fails and callers report time alone.
+//
+// The counters run as one group, so they are always scheduled together and
+// every ratio between them covers the same instructions.
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+#define PERF_CYCLES 0
+#define PERF_INSTRUCTIONS 1
+#define PERF_L1D_MISSES 2 // Data reads that missed L1
+#define PERF_LLC_MISSES 3 // References that missed the last-level cache
+#define PERF_BRANCH_MISSES 4
+#define PERF_COUNTERS 5
+
+static const char* const perf_counter_names[PERF_COUNTERS] = {
+    "cycles", "instructions", "L1D misses", "LLC misses", "branch misses"
+};
+
+typedef struct {
+    int fds[PERF_COUNTERS]; // -1 where the counter is not available
+    int order[PERF_COUNTERS]; // Counters in group order, as read() returns them
+    int count;
+    unsigned int available; // Bit per PERF_* counter
+} PerfCounters;
+
+typedef struct {
+    uint64_t values[PERF_COUNTERS]; // 0 for counters that are not available
+} PerfSample;
+
+static inline int perf_counter_open(int counter, int group) {
+    static const struct { uint32_t type; uint64_t config; } events[PERF_COUNTERS] = {
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+        { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                              (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    };
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = events[counter].type;
+    attr.config = events[counter].config;
+    attr.disabled = group < 0; // The leader starts the group once it is complete
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+static inline void perf_counters_close(PerfCounters* pc) {
+    for (int i = 0; i < PERF_COUNTERS; i++) {
+        if (pc->fds[i] >= 0) close(pc->fds[i]);
+        pc->fds[i] = -1;
+    }
+    pc->count = 0;
+    pc->available = 0;
+}
+
+// Returns how many counters run, 0 with errno set from the first failure
+// if none can
+static inline int perf_counters_open(PerfCounters* pc) {
+    int error = 0;
+    int leader = -1;
+    pc->count = 0;
+    pc->available = 0;
+    for (int i = 0; i < PERF_COUNTERS; i++) {
+        pc->fds[i] = perf_counter_open(i, leader);
+        if (pc->fds[i] < 0) {
+            if (!error) error = errno;
+            continue;
+        }
+        if (leader < 0) leader = pc->fds[i];
+        pc->order[pc->count++] = i;
+        pc->available |= 1u << i;
+    }
+    if (leader < 0 || ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP) != 0) {
+        if (leader >= 0) error = errno;
+        perf_counters_close(pc);
+        errno = error;
+        return 0;
+    }
+    return pc->count;
+}
+
+// Counts since perf_counters_open(), scaled up if the kernel had to share
+// the hardware with other groups. Returns 0 if the group cannot be read or
+// has not been on the CPU yet.
+static inline int perf_counters_read(const PerfCounters* pc, PerfSample* sample) {
+    uint64_t data[3 + PERF_COUNTERS]; // nr, time enabled, time running, values
+    memset(sample, 0, sizeof(*sample));
+    if (pc->count == 0) return 0;
+    ssize_t size = read(pc->fds[pc->order[0]], data, sizeof(data));
+    if (size < (ssize_t)(3 * sizeof(uint64_t)) || data[0] != (uint64_t)pc->count || data[2] == 0) return 0;
+
+    double scale = (double)data[1] / (double)data[2];
+    for (int i = 0; i < pc->count; i++) {
+        uint64_t value = data[3 + i];
+        sample->values[pc->order[i]] = scale > 1.0 ? (uint64_t)(value * scale) : value;
+    }
+    return 1;
+}
+
+// Scaled counts can step back slightly when the scale changes
+static inline void perf_sample_add_delta(PerfSample* total, const PerfSample* start, const PerfSample* end) {
+    for (int i = 0; i < PERF_COUNTERS; i++) {
+        if (end->values[i] > start->values[i]) total->values[i] += end->values[i] - start->values[i];
+    }
+}
+
+#endif
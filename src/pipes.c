@@ -1,21 +1,38 @@
+#ifdef __EMSCRIPTEN__
 #include <emscripten.h>
+#else
+#define EMSCRIPTEN_KEEPALIVE
+#endif
+#include <stdint.h>
 #include <stdlib.h>
 #include <math.h>
 #include <string.h>
 #include <time.h>
+#if defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "pipes.h"
+#include "arena.h"
+#include "draw_events.h"
+#include "free_cells.h"
+#include "neighbor_grid.h"
+#include "snapshot.h"
+#include "trace.h"
+#include "worker_pool.h"
 
-#define MAX_PIPES 10
+#define DEFAULT_PIPE_CAPACITY 10
+#define MAX_PIPE_CAPACITY 131072
 #define GRID_SIZE 30
 #define PIPE_RADIUS 12
 #define SEGMENT_LENGTH (GRID_SIZE)
 #define MAX_PIPE_LENGTH 50
-
-// Tunable parameters
-static int fade_speed = 1;
-static int spawn_rate = 10;
-static int turn_probability = 30;
-static int max_active_pipes = 3;
-static int animation_speed = 60; // FPS
+#define MAX_STEPS_PER_FRAME 10000
+#define MAX_STAMP_RADIUS (PIPE_RADIUS + 2)
+#define GRID_DEPTH 30
+#define RECYCLE_OCCUPANCY 85 // Percent of cells claimed before the grid is cleared
+#define TILE_SHIFT 6 // log2(PIPES_TILE_SIZE)
 
 typedef struct {
     int x, y, z;
@@ -30,30 +47,88 @@ typedef enum {
     DIR_BACKWARD = 5
 } Direction;
 
+// Grid step of each Direction, opposite directions paired as neighbor_grid.h expects
+static const signed char direction_steps[6][3] = {
+    { 1, 0, 0 }, { -1, 0, 0 }, { 0, -1, 0 }, { 0, 1, 0 }, { 0, 0, 1 }, { 0, 0, -1 }
+};
+
 typedef enum {
     PIPE_STRAIGHT,
     PIPE_ELBOW,
     PIPE_JOINT
 } PipeType;
 
+// What happened to a pipe in the current phased step
+#define PIPE_MOVED 1
+#define PIPE_WAITED 2 // The cell ahead was taken or went to a lower index
+#define PIPE_TURNED 4
+#define PIPE_DIED 8 // Left the screen, or waited with no way out
+
 typedef struct {
     Point3D pos;
     Direction dir;
     int color;
     int active;
     int length;
+    unsigned int random_state; // Own stream, so phased steps do not depend on thread timing
+    // Phased stepping scratch, valid during one step
+    Point3D from;
+    int bid; // Cell bid for
+    int events;
 } Pipe;
 
 typedef struct {
     int width;
     int height;
     unsigned char* framebuffer;
-    int*** grid; // 3D grid to track occupied spaces
-    Pipe pipes[MAX_PIPES];
+    NeighborGrid grid; // Occupied cells and their free neighbors, indexed by cell_index()
+    int grid_width;
+    int grid_height;
+    FreeCells free_cells; // Unclaimed cells, indexed by cell_index()
+    unsigned int* bids; // Phased stepping only: lowest pipe index bidding for each cell
+    Pipe* pipes;
+    int pipe_capacity;
     int active_pipes;
+    int first_free; // No inactive pipe slot below this index
+    // Dirty presentation only: tiles drawn to since the last pipes_update()
+    unsigned char* tile_marks; // One byte per tile
+    int* dirty_tiles; // Indices of the marked tiles, ascending
+    int dirty_count;
+    int tiles_x;
+    int tiles_y;
 } PipeSystem;
 
-static PipeSystem* pipe_system = NULL;
+struct PipesContext {
+    // Tunable parameters
+    int fade_speed;
+    int spawn_rate;
+    int turn_probability;
+    int max_active_pipes;
+    int animation_speed; // FPS
+    int steps_per_frame;
+    int pipe_capacity; // Applied by pipes_init()
+    int worker_threads; // Phased stepping when > 0, applied by pipes_init()
+    int present_mode; // PIPES_PRESENT_*, applied by pipes_init()
+    int frame_fade; // Fade the last pipes_update() applied, or left to the caller
+    int glow; // Upper bound of any channel in the image, 0 once it is black
+    int frame_state; // PIPES_FRAME_* of the last pipes_update()
+    unsigned char* frame_target; // Where the next frame goes, NULL to stay in place
+    const unsigned char* snapshot_image; // Caller's image for the next dirty-mode snapshot
+    
+    unsigned int random_state; // Per instance, so instances never interleave
+    Arena arena; // All per-instance buffers, system included, are carved from it
+    PipeSystem* system; // NULL until pipes_init()
+    MemoryUsage memory_usage;
+    CommandRing command_ring;
+    WorkerPool workers;
+    DrawEventLog events; // Grows with the caller's drain interval, so kept out of the arena
+    int record_events;
+};
+
+#define NO_BID 0xFFFFFFFFu
+
+// Seeds instances created within the same second apart
+static unsigned int instances_created = 0;
 
 // Color palette for pipes
 static const unsigned int pipe_colors[] = {
@@ -67,99 +142,448 @@ static const unsigned int pipe_colors[] = {
     0xFF8844FF  // Purple
 };
 
+// xorshift32, in rand()'s 0..2^31-1 range
+static int random_from(unsigned int* state) {
+    unsigned int x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return (int)(x >> 1);
+}
+
+static int next_random(PipesContext* ctx) {
+    return random_from(&ctx->random_state);
+}
+
+// Seed for the stream of the pipe in slot index, derived from the instance
+// state without advancing it so serial stepping is unaffected
+static unsigned int pipe_seed(unsigned int state, int index) {
+    unsigned int x = (state ^ ((unsigned int)index * 0x9E3779B9u)) * 0x85EBCA6Bu;
+    x ^= x >> 16;
+    return x ? x : 1;
+}
+
+static void seed_random(PipesContext* ctx) {
+    unsigned int instance = __atomic_add_fetch(&instances_created, 1, __ATOMIC_RELAXED);
+    unsigned int seed = (unsigned int)time(NULL) ^ (instance * 0x9E3779B9u);
+    ctx->random_state = seed ? seed : 1;
+}
+
+static int cell_index(const PipeSystem* ps, int gx, int gy, int gz) {
+    return (gx * ps->grid_height + gy) * GRID_DEPTH + gz;
+}
+
+static int position_cell(const PipeSystem* ps, Point3D pos) {
+    return cell_index(ps, pos.x / GRID_SIZE, pos.y / GRID_SIZE, pos.z);
+}
+
+static void claim_cell(PipeSystem* ps, int gx, int gy, int gz) {
+    neighbor_grid_claim(&ps->grid, gx, gy, gz);
+    free_cells_claim(&ps->free_cells, cell_index(ps, gx, gy, gz));
+}
+
+// A pipe centered in this column/row would be out of bounds immediately
+static int is_usable_cell(const PipeSystem* ps, int gx, int gy) {
+    int x = gx * GRID_SIZE + GRID_SIZE / 2;
+    int y = gy * GRID_SIZE + GRID_SIZE / 2;
+    return x >= PIPE_RADIUS && x < ps->width - PIPE_RADIUS &&
+           y >= PIPE_RADIUS && y < ps->height - PIPE_RADIUS;
+}
+
+// Derive the neighbor masks and the free-cell index from plain occupancy
+// (nonzero bytes) in the grid. Cells at the edges that can never host a pipe
+// are claimed so neither spawns nor turns pick them.
+static void sync_grid(PipeSystem* ps) {
+    for (int x = 0; x < ps->grid_width; x++) {
+        for (int y = 0; y < ps->grid_height; y++) {
+            if (!is_usable_cell(ps, x, y)) {
+                memset(ps->grid.cells + cell_index(ps, x, y, 0), 1, GRID_DEPTH);
+            }
+        }
+    }
+    neighbor_grid_rebuild(&ps->grid);
+    
+    free_cells_reset(&ps->free_cells);
+    for (int cell = 0; cell < ps->free_cells.total; cell++) {
+        if (neighbor_grid_occupied(&ps->grid, cell)) free_cells_claim(&ps->free_cells, cell);
+    }
+}
+
+// Free every cell except the ones under active pipe heads
+static void clear_grid(PipeSystem* ps) {
+    memset(ps->grid.cells, 0, (size_t)ps->free_cells.total);
+    for (int i = 0; i < ps->pipe_capacity; i++) {
+        Pipe* pipe = &ps->pipes[i];
+        if (pipe->active) {
+            ps->grid.cells[position_cell(ps, pipe->pos)] = 1;
+        }
+    }
+    sync_grid(ps);
+}
+
+static void retire_pipe(PipeSystem* ps, Pipe* pipe) {
+    int index = (int)(pipe - ps->pipes);
+    pipe->active = 0;
+    ps->active_pipes--;
+    if (index < ps->first_free) ps->first_free = index;
+}
+
+// Draw-event recording, see src/draw_events.h. Cells go out as grid
+// coordinates and moves as directions, so a segment costs a few bytes.
+static void record_pipe(PipesContext* ctx, int type, int arg, const Pipe* pipe) {
+    if (ctx->record_events) draw_events_pipe(&ctx->events, type, arg, (int)(pipe - ctx->system->pipes));
+}
+
+static void record_spawn(PipesContext* ctx, const Pipe* pipe) {
+    if (!ctx->record_events) return;
+    draw_events_spawn(&ctx->events, (int)(pipe - ctx->system->pipes), pipe->dir,
+                      pipe->pos.x / GRID_SIZE, pipe->pos.y / GRID_SIZE, pipe->pos.z, pipe->color);
+}
+
+// A RESET and the live pipes, where a display can join the stream
+static void record_scene(PipesContext* ctx) {
+    PipeSystem* ps = ctx->system;
+    if (!ctx->record_events || !ps) return;
+    unsigned int size[3] = { (unsigned int)ps->width, (unsigned int)ps->height, (unsigned int)ps->pipe_capacity };
+    draw_events_put(&ctx->events, DRAW_EVENT_RESET, DRAW_EVENTS_SOFTWARE, 3, size);
+    for (int i = 0; i < ps->pipe_capacity; i++) {
+        if (ps->pipes[i].active) record_spawn(ctx, &ps->pipes[i]);
+    }
+}
+
+// Distance from the stamp center, so circles cost no sqrt per pixel. Every
+// segment stamps a dozen circles, which adds up in turbo frames.
+static float stamp_distance[2 * MAX_STAMP_RADIUS + 1][2 * MAX_STAMP_RADIUS + 1];
+static int stamp_ready = 0;
+
+static void init_stamp() {
+    for (int y = -MAX_STAMP_RADIUS; y <= MAX_STAMP_RADIUS; y++) {
+        for (int x = -MAX_STAMP_RADIUS; x <= MAX_STAMP_RADIUS; x++) {
+            stamp_distance[y + MAX_STAMP_RADIUS][x + MAX_STAMP_RADIUS] = sqrtf(x * x + y * y);
+        }
+    }
+    stamp_ready = 1;
+}
+
+// Arena layout for an instance of the given size; every buffer is rounded
+// up to the arena alignment so the sizes add up to what pipes_init() carves.
+// Phased stepping adds a bid per cell, counted under grid, and dirty
+// presentation a mark and a list entry per tile, counted under framebuffer.
+static MemoryUsage plan_memory(int width, int height, int capacity, int phased, int dirty) {
+    int grid_width = width / GRID_SIZE + 1;
+    int grid_height = height / GRID_SIZE + 1;
+    int cells = grid_width * grid_height * GRID_DEPTH;
+    int tiles = ((width + PIPES_TILE_SIZE - 1) >> TILE_SHIFT) * ((height + PIPES_TILE_SIZE - 1) >> TILE_SHIFT);
+    
+    MemoryUsage plan = { 0 };
+    plan.system = arena_align(sizeof(PipeSystem));
+    plan.pipes = arena_align((size_t)capacity * sizeof(Pipe));
+    plan.framebuffer = arena_align((size_t)width * height * 4) +
+                       (dirty ? arena_align((size_t)tiles) + arena_align((size_t)tiles * sizeof(int)) : 0);
+    plan.grid = arena_align((size_t)cells) + (phased ? arena_align((size_t)cells * sizeof(unsigned int)) : 0);
+    plan.free_cells = arena_align(free_cells_bytes(cells));
+    plan.arena_used = plan.system + plan.pipes + plan.framebuffer + plan.grid + plan.free_cells;
+    return plan;
+}
+
+EMSCRIPTEN_KEEPALIVE
+PipesContext* pipes_create() {
+    PipesContext* ctx = (PipesContext*)calloc(1, sizeof(PipesContext));
+    if (!ctx) return NULL;
+    
+    ctx->fade_speed = 1;
+    ctx->spawn_rate = 10;
+    ctx->turn_probability = 30;
+    ctx->max_active_pipes = 3;
+    ctx->animation_speed = 60;
+    ctx->steps_per_frame = 1;
+    ctx->pipe_capacity = DEFAULT_PIPE_CAPACITY;
+    command_ring_init(&ctx->command_ring);
+    seed_random(ctx);
+    return ctx;
+}
+
+EMSCRIPTEN_KEEPALIVE
+void pipes_destroy(PipesContext* ctx) {
+    if (!ctx) return;
+    worker_pool_stop(&ctx->workers);
+    arena_destroy(&ctx->arena);
+    draw_events_free(&ctx->events);
+    free(ctx);
+}
+
 EMSCRIPTEN_KEEPALIVE
-void init_pipes(int width, int height) {
+void pipes_init(PipesContext* ctx, int width, int height) {
     // Validate dimensions
     if (width <= 0 || height <= 0) return;
+    TRACE_SCOPE("pipes_init");
     
-    if (pipe_system) {
-        // Free existing grid
-        if (pipe_system->grid) {
-            int old_grid_width = pipe_system->width / GRID_SIZE + 1;
-            int old_grid_height = pipe_system->height / GRID_SIZE + 1;
-            for (int x = 0; x < old_grid_width; x++) {
-                for (int y = 0; y < old_grid_height; y++) {
-                    free(pipe_system->grid[x][y]);
-                }
-                free(pipe_system->grid[x]);
-            }
-            free(pipe_system->grid);
-        }
-        if (pipe_system->framebuffer) {
-            free(pipe_system->framebuffer);
-        }
-        free(pipe_system);
+    // Reuses the current arena when the new size fits in it
+    MemoryUsage plan = plan_memory(width, height, ctx->pipe_capacity, ctx->worker_threads > 0,
+                                     ctx->present_mode == PIPES_PRESENT_DIRTY);
+    ctx->system = NULL;
+    size_t old_capacity = ctx->arena.capacity;
+    if (!arena_reset(&ctx->arena, plan.arena_used)) {
+        memset(&ctx->memory_usage, 0, sizeof(ctx->memory_usage));
+        return;
     }
+    if (ctx->arena.capacity != old_capacity) TRACE_INSTANT("arena realloc");
+    ctx->memory_usage = plan;
+    ctx->memory_usage.arena_capacity = ctx->arena.capacity;
     
-    pipe_system = (PipeSystem*)malloc(sizeof(PipeSystem));
-    pipe_system->width = width;
-    pipe_system->height = height;
-    pipe_system->active_pipes = 0;
-    pipe_system->framebuffer = (unsigned char*)malloc(width * height * 4);
+    PipeSystem* ps = (PipeSystem*)arena_alloc(&ctx->arena, plan.system);
+    *ps = (PipeSystem){ 0 };
+    ps->width = width;
+    ps->height = height;
+    ps->active_pipes = 0;
+    ps->pipe_capacity = ctx->pipe_capacity;
+    ps->pipes = (Pipe*)arena_alloc(&ctx->arena, plan.pipes);
+    ps->framebuffer = (unsigned char*)arena_alloc(&ctx->arena, (size_t)width * height * 4);
+    if (ctx->present_mode == PIPES_PRESENT_DIRTY) {
+        ps->tiles_x = (width + PIPES_TILE_SIZE - 1) >> TILE_SHIFT;
+        ps->tiles_y = (height + PIPES_TILE_SIZE - 1) >> TILE_SHIFT;
+        int tiles = ps->tiles_x * ps->tiles_y;
+        ps->tile_marks = (unsigned char*)arena_alloc(&ctx->arena, (size_t)tiles);
+        ps->dirty_tiles = (int*)arena_alloc(&ctx->arena, (size_t)tiles * sizeof(int));
+        memset(ps->tile_marks, 0, (size_t)tiles);
+    }
     
     // Initialize 3D grid
     int grid_width = width / GRID_SIZE + 1;
     int grid_height = height / GRID_SIZE + 1;
-    int grid_depth = 30; // Z depth
-    
-    pipe_system->grid = (int***)malloc(grid_width * sizeof(int**));
-    for (int x = 0; x < grid_width; x++) {
-        pipe_system->grid[x] = (int**)malloc(grid_height * sizeof(int*));
-        for (int y = 0; y < grid_height; y++) {
-            pipe_system->grid[x][y] = (int*)calloc(grid_depth, sizeof(int));
-        }
+    int cells = grid_width * grid_height * GRID_DEPTH;
+    ps->grid_width = grid_width;
+    ps->grid_height = grid_height;
+    neighbor_grid_attach(&ps->grid, (unsigned char*)arena_alloc(&ctx->arena, (size_t)cells),
+                         grid_width, grid_height, GRID_DEPTH, direction_steps);
+    free_cells_attach(&ps->free_cells, cells, arena_alloc(&ctx->arena, plan.free_cells));
+    if (ctx->worker_threads > 0) {
+        ps->bids = (unsigned int*)arena_alloc(&ctx->arena, (size_t)cells * sizeof(unsigned int));
+        memset(ps->bids, 0xFF, (size_t)cells * sizeof(unsigned int));
     }
     
-    // Clear framebuffer to black
-    memset(pipe_system->framebuffer, 0, width * height * 4);
+    // The stamp is read by every worker, so build it before any can draw
+    if (!stamp_ready) init_stamp();
     
-    // Set alpha channel
-    for (int i = 3; i < width * height * 4; i += 4) {
-        pipe_system->framebuffer[i] = 255;
+    // Clear framebuffer to black, or to transparent for dirty presentation
+    memset(ps->framebuffer, 0, (size_t)width * height * 4);
+    if (!ps->tile_marks) {
+        for (int i = 3; i < width * height * 4; i += 4) {
+            ps->framebuffer[i] = 255;
+        }
     }
+    ctx->frame_fade = 0;
+    ctx->glow = 0;
+    ctx->frame_state = 0;
+    ctx->frame_target = NULL; // Sized for the old framebuffer
+    ctx->snapshot_image = NULL;
     
     // Initialize pipes
-    for (int i = 0; i < MAX_PIPES; i++) {
-        pipe_system->pipes[i].active = 0;
-    }
+    memset(ps->pipes, 0, (size_t)ps->pipe_capacity * sizeof(Pipe));
     
-    srand(time(NULL));
+    clear_grid(ps);
+    ctx->system = ps;
+    
+    seed_random(ctx);
+    record_scene(ctx);
+}
+
+// Bytes pipes_init() needs for this size, to size the heap up front instead
+// of growing it mid-session
+EMSCRIPTEN_KEEPALIVE
+unsigned int pipes_get_memory_required(PipesContext* ctx, int width, int height) {
+    if (width <= 0 || height <= 0) return 0;
+    return plan_memory(width, height, ctx->pipe_capacity, ctx->worker_threads > 0,
+                       ctx->present_mode == PIPES_PRESENT_DIRTY).arena_used;
+}
+
+// Grow the arena ahead of time for sizes up to width x height, e.g. the
+// whole screen, so later resizes never grow the heap. A running instance is
+// restarted if its buffers have to move. Returns 0 if allocation failed.
+EMSCRIPTEN_KEEPALIVE
+int pipes_reserve_memory(PipesContext* ctx, int width, int height) {
+    size_t required = pipes_get_memory_required(ctx, width, height);
+    if (required <= ctx->arena.capacity) return 1;
+    
+    int restart_width = ctx->system ? ctx->system->width : 0;
+    int restart_height = ctx->system ? ctx->system->height : 0;
+    ctx->system = NULL;
+    memset(&ctx->memory_usage, 0, sizeof(ctx->memory_usage));
+    if (!arena_reset(&ctx->arena, required)) return 0;
+    
+    ctx->memory_usage.arena_capacity = ctx->arena.capacity;
+    if (restart_width > 0) pipes_init(ctx, restart_width, restart_height);
+    return 1;
+}
+
+EMSCRIPTEN_KEEPALIVE
+MemoryUsage* pipes_get_memory_usage(PipesContext* ctx) {
+    return &ctx->memory_usage;
+}
+
+EMSCRIPTEN_KEEPALIVE
+CommandRing* pipes_get_command_ring(PipesContext* ctx) {
+    return &ctx->command_ring;
+}
+
+EMSCRIPTEN_KEEPALIVE
+unsigned char* pipes_get_framebuffer(PipesContext* ctx) {
+    return ctx->system ? ctx->system->framebuffer : NULL;
+}
+
+EMSCRIPTEN_KEEPALIVE
+int pipes_get_width(PipesContext* ctx) {
+    return ctx->system ? ctx->system->width : 0;
 }
 
 EMSCRIPTEN_KEEPALIVE
-unsigned char* get_framebuffer() {
-    return pipe_system ? pipe_system->framebuffer : NULL;
+int pipes_get_height(PipesContext* ctx) {
+    return ctx->system ? ctx->system->height : 0;
 }
 
 // Parameter setters
 EMSCRIPTEN_KEEPALIVE
-void set_fade_speed(int speed) {
-    fade_speed = speed;
+void pipes_set_fade_speed(PipesContext* ctx, int speed) {
+    ctx->fade_speed = speed;
 }
 
 EMSCRIPTEN_KEEPALIVE
-void set_spawn_rate(int rate) {
-    spawn_rate = rate;
+void pipes_set_spawn_rate(PipesContext* ctx, int rate) {
+    ctx->spawn_rate = rate;
 }
 
 EMSCRIPTEN_KEEPALIVE
-void set_turn_probability(int prob) {
-    turn_probability = prob;
+void pipes_set_turn_probability(PipesContext* ctx, int prob) {
+    ctx->turn_probability = prob;
 }
 
 EMSCRIPTEN_KEEPALIVE
-void set_max_pipes(int max) {
-    max_active_pipes = max;
+void pipes_set_max_pipes(PipesContext* ctx, int max) {
+    ctx->max_active_pipes = max;
 }
 
 EMSCRIPTEN_KEEPALIVE
-void set_animation_speed(int fps) {
-    animation_speed = fps;
+void pipes_set_animation_speed(PipesContext* ctx, int fps) {
+    ctx->animation_speed = fps;
 }
 
-static void draw_circle_3d(int cx, int cy, int radius, int z, unsigned int color, float intensity) {
-    if (!pipe_system) return;
-    
+// Upper bound on concurrent pipes, the limit pipes_set_max_pipes() can
+// reach. Sizes the pipe table, so it takes effect on the next pipes_init().
+EMSCRIPTEN_KEEPALIVE
+void pipes_set_pipe_capacity(PipesContext* ctx, int capacity) {
+    if (capacity < 1) capacity = 1;
+    if (capacity > MAX_PIPE_CAPACITY) capacity = MAX_PIPE_CAPACITY;
+    ctx->pipe_capacity = capacity;
+}
+
+// Simulation steps per pipes_update() call, for fast-fill and time-lapse
+EMSCRIPTEN_KEEPALIVE
+void pipes_set_steps_per_frame(PipesContext* ctx, int steps) {
+    if (steps < 1) steps = 1;
+    if (steps > MAX_STEPS_PER_FRAME) steps = MAX_STEPS_PER_FRAME;
+    ctx->steps_per_frame = steps;
+}
+
+// Step in phases spread over this many threads, caller included; 0 keeps
+// the classic serial step. Phased results depend only on the seed, not on
+// the thread count, but differ from serial ones. Takes effect on the next
+// pipes_init(). Native builds only: WebAssembly has no threaded build, so
+// there the phases all run on the calling thread.
+EMSCRIPTEN_KEEPALIVE
+void pipes_set_worker_threads(PipesContext* ctx, int threads) {
+    if (threads <= 0) {
+        worker_pool_stop(&ctx->workers);
+        ctx->worker_threads = 0;
+        return;
+    }
+    ctx->worker_threads = worker_pool_start(&ctx->workers, threads);
+}
+
+// PIPES_PRESENT_DIRTY leaves the fade to the caller, see pipes.h. Takes
+// effect on the next pipes_init().
+EMSCRIPTEN_KEEPALIVE
+void pipes_set_present_mode(PipesContext* ctx, int mode) {
+    ctx->present_mode = mode == PIPES_PRESENT_DIRTY ? PIPES_PRESENT_DIRTY : PIPES_PRESENT_FULL;
+}
+
+EMSCRIPTEN_KEEPALIVE
+int pipes_get_frame_fade(PipesContext* ctx) {
+    return ctx->frame_fade;
+}
+
+EMSCRIPTEN_KEEPALIVE
+int pipes_set_frame_target(PipesContext* ctx, unsigned char* pixels) {
+    if (!ctx->system || ctx->system->tile_marks) return 0;
+    ctx->frame_target = pixels;
+    return 1;
+}
+
+EMSCRIPTEN_KEEPALIVE
+int pipes_get_frame_state(PipesContext* ctx) {
+    return ctx->frame_state;
+}
+
+EMSCRIPTEN_KEEPALIVE
+int pipes_get_dirty_tile_count(PipesContext* ctx) {
+    return ctx->system ? ctx->system->dirty_count : 0;
+}
+
+EMSCRIPTEN_KEEPALIVE
+int* pipes_get_dirty_tiles(PipesContext* ctx) {
+    return ctx->system ? ctx->system->dirty_tiles : NULL;
+}
+
+// Log what every step draws for pipes_replay() elsewhere. Starting records
+// the current scene first; stopping drops the log.
+EMSCRIPTEN_KEEPALIVE
+void pipes_set_event_recording(PipesContext* ctx, int enabled) {
+    int was_recording = ctx->record_events;
+    ctx->record_events = enabled != 0;
+    if (!enabled) {
+        draw_events_free(&ctx->events);
+    } else if (!was_recording) {
+        record_scene(ctx);
+    }
+}
+
+EMSCRIPTEN_KEEPALIVE
+unsigned char* pipes_get_events(PipesContext* ctx) {
+    return ctx->events.data;
+}
+
+EMSCRIPTEN_KEEPALIVE
+unsigned int pipes_get_event_size(PipesContext* ctx) {
+    return (unsigned int)ctx->events.size;
+}
+
+// Once the caller has sent the events on
+EMSCRIPTEN_KEEPALIVE
+void pipes_clear_events(PipesContext* ctx) {
+    draw_events_clear(&ctx->events);
+}
+
+// Framebuffer rows [top, bottom) a draw may touch. Phased stepping gives each
+// worker its own band so no two threads write the same pixel.
+typedef struct {
+    int top, bottom;
+} Band;
+
+static Band full_band(const PipeSystem* ps) {
+    return (Band){ 0, ps->height };
+}
+
+// Mark the tiles under the pixel rectangle (x0, y0)-(x1, y1) as drawn to.
+// Bands of phased workers can share a tile, hence the atomic stores.
+static void mark_tiles(PipeSystem* ps, int x0, int y0, int x1, int y1) {
+    for (int ty = y0 >> TILE_SHIFT; ty <= y1 >> TILE_SHIFT; ty++) {
+        for (int tx = x0 >> TILE_SHIFT; tx <= x1 >> TILE_SHIFT; tx++) {
+            __atomic_store_n(&ps->tile_marks[ty * ps->tiles_x + tx], 1, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static void draw_circle_3d(PipeSystem* ps, Band band, int cx, int cy, int radius, int z, unsigned int color, float intensity) {
     // Extract RGB components
     unsigned char r = (color >> 16) & 0xFF;
     unsigned char g = (color >> 8) & 0xFF;
@@ -171,38 +595,49 @@ static void draw_circle_3d(int cx, int cy, int radius, int z, unsigned int color
     g = (unsigned char)(g * intensity * depth_factor);
     b = (unsigned char)(b * intensity * depth_factor);
     
+    // Clip the stamp to the band once instead of per pixel
+    if (cx + radius < 0 || cx - radius >= ps->width ||
+        cy + radius < band.top || cy - radius >= band.bottom) {
+        return;
+    }
+    int y0 = cy - radius < band.top ? band.top - cy : -radius;
+    int y1 = cy + radius >= band.bottom ? band.bottom - 1 - cy : radius;
+    int x0 = cx - radius < 0 ? -cx : -radius;
+    int x1 = cx + radius >= ps->width ? ps->width - 1 - cx : radius;
+    if (ps->tile_marks) mark_tiles(ps, cx + x0, cy + y0, cx + x1, cy + y1);
+    
     // Draw filled circle with 3D shading
-    for (int y = -radius; y <= radius; y++) {
-        for (int x = -radius; x <= radius; x++) {
-            float dist = sqrtf(x * x + y * y);
+    for (int y = y0; y <= y1; y++) {
+        const float* dist_row = stamp_distance[y + MAX_STAMP_RADIUS] + MAX_STAMP_RADIUS;
+        unsigned char* row = ps->framebuffer + ((cy + y) * ps->width + cx) * 4;
+        for (int x = x0; x <= x1; x++) {
+            float dist = dist_row[x];
             if (dist <= radius) {
-                int px = cx + x;
-                int py = cy + y;
+                // Calculate 3D shading
+                float norm_dist = dist / radius;
+                float shade = 1.0f - norm_dist * 0.6f;
                 
-                if (px >= 0 && px < pipe_system->width && py >= 0 && py < pipe_system->height) {
-                    // Calculate 3D shading
-                    float norm_dist = dist / radius;
-                    float shade = 1.0f - norm_dist * 0.6f;
-                    
-                    // Add highlight for 3D effect
-                    float highlight = 0.0f;
-                    if (norm_dist < 0.5f) {
-                        highlight = (0.5f - norm_dist) * 0.4f;
-                    }
-                    
-                    int idx = (py * pipe_system->width + px) * 4;
-                    pipe_system->framebuffer[idx] = fmin(255, r * shade + 255 * highlight);
-                    pipe_system->framebuffer[idx + 1] = fmin(255, g * shade + 255 * highlight);
-                    pipe_system->framebuffer[idx + 2] = fmin(255, b * shade + 255 * highlight);
+                // Add highlight for 3D effect
+                float highlight = 0.0f;
+                if (norm_dist < 0.5f) {
+                    highlight = (0.5f - norm_dist) * 0.4f;
                 }
+                
+                float vr = r * shade + 255 * highlight;
+                float vg = g * shade + 255 * highlight;
+                float vb = b * shade + 255 * highlight;
+                unsigned char* px = row + x * 4;
+                px[0] = vr < 255 ? (unsigned char)vr : 255;
+                px[1] = vg < 255 ? (unsigned char)vg : 255;
+                px[2] = vb < 255 ? (unsigned char)vb : 255;
+                px[3] = 255;
             }
         }
     }
 }
 
-static void draw_cylinder_segment(Point3D start, Point3D end, int radius, unsigned int color) {
-    if (!pipe_system) return;
-    
+static void draw_cylinder_segment(PipeSystem* ps, Band band, Point3D start, Point3D end, int radius, unsigned int color) {
+    TRACE_SCOPE("rasterize segment");
     // Calculate 2D projection
     int x1 = start.x;
     int y1 = start.y - start.z / 2; // Simple 3D projection
@@ -225,201 +660,708 @@ static void draw_cylinder_segment(Point3D start, Point3D end, int radius, unsign
         int z = start.z + (int)(dz * t);
         
         // Draw circle at this position
-        draw_circle_3d(x, y, radius, z, color, 1.0f);
+        draw_circle_3d(ps, band, x, y, radius, z, color, 1.0f);
     }
 }
 
-static void draw_elbow(Point3D pos, Direction from_dir, Direction to_dir, int radius, unsigned int color) {
-    if (!pipe_system) return;
-    
+static void draw_elbow(PipeSystem* ps, Band band, Point3D pos, Direction from_dir, Direction to_dir, int radius, unsigned int color) {
+    TRACE_SCOPE("rasterize elbow");
     // Draw a joint/elbow at the turn
     int x = pos.x;
     int y = pos.y - pos.z / 2;
     
     // Draw a larger sphere for the joint
-    draw_circle_3d(x, y, radius + 2, pos.z, color, 1.2f);
+    draw_circle_3d(ps, band, x, y, radius + 2, pos.z, color, 1.2f);
 }
 
-static int is_valid_position(int gx, int gy, int gz) {
-    int grid_width = pipe_system->width / GRID_SIZE + 1;
-    int grid_height = pipe_system->height / GRID_SIZE + 1;
-    
-    if (gx < 0 || gx >= grid_width || gy < 0 || gy >= grid_height || gz < 0 || gz >= 30) {
-        return 0;
-    }
-    
-    return pipe_system->grid[gx][gy][gz] == 0;
+// Random free direction out of the cell at pos, never straight back.
+// Directions into cells with no way onward are only taken as a last resort.
+static Direction get_new_direction(const PipeSystem* ps, unsigned int* random_state, Point3D pos, Direction current_dir) {
+    TRACE_SCOPE("get_new_direction");
+    int cell = position_cell(ps, pos);
+    unsigned int mask = neighbor_grid_free(&ps->grid, cell) & ~(1u << (current_dir ^ 1));
+    mask = neighbor_grid_avoid_dead_ends(&ps->grid, cell, mask);
+    return (Direction)neighbor_pick(mask, random_from(random_state));
 }
 
-static Direction get_new_direction(Point3D pos, Direction current_dir) {
-    Direction possible_dirs[6];
-    int count = 0;
-    
-    // Check all 6 directions except the opposite of current
-    for (int d = 0; d < 6; d++) {
-        if ((d == DIR_RIGHT && current_dir == DIR_LEFT) ||
-            (d == DIR_LEFT && current_dir == DIR_RIGHT) ||
-            (d == DIR_UP && current_dir == DIR_DOWN) ||
-            (d == DIR_DOWN && current_dir == DIR_UP) ||
-            (d == DIR_FORWARD && current_dir == DIR_BACKWARD) ||
-            (d == DIR_BACKWARD && current_dir == DIR_FORWARD)) {
-            continue;
-        }
-        
-        int gx = pos.x / GRID_SIZE;
-        int gy = pos.y / GRID_SIZE;
-        int gz = pos.z;
-        
-        switch (d) {
-            case DIR_RIGHT: gx++; break;
-            case DIR_LEFT: gx--; break;
-            case DIR_UP: gy--; break;
-            case DIR_DOWN: gy++; break;
-            case DIR_FORWARD: gz++; break;
-            case DIR_BACKWARD: gz--; break;
-        }
-        
-        if (is_valid_position(gx, gy, gz)) {
-            possible_dirs[count++] = d;
-        }
+static Point3D advance(Point3D pos, Direction dir) {
+    switch (dir) {
+        case DIR_RIGHT: pos.x += SEGMENT_LENGTH; break;
+        case DIR_LEFT: pos.x -= SEGMENT_LENGTH; break;
+        case DIR_UP: pos.y -= SEGMENT_LENGTH; break;
+        case DIR_DOWN: pos.y += SEGMENT_LENGTH; break;
+        case DIR_FORWARD: pos.z += 1; break;
+        case DIR_BACKWARD: pos.z -= 1; break;
     }
-    
-    if (count == 0) return -1;
-    return possible_dirs[rand() % count];
+    return pos;
 }
 
-static void spawn_pipe() {
-    if (pipe_system->active_pipes >= MAX_PIPES) return;
+// Direction of a one-cell move
+static Direction step_direction(Point3D from, Point3D to) {
+    if (to.x != from.x) return to.x > from.x ? DIR_RIGHT : DIR_LEFT;
+    if (to.y != from.y) return to.y > from.y ? DIR_DOWN : DIR_UP;
+    return to.z > from.z ? DIR_FORWARD : DIR_BACKWARD;
+}
+
+static int inside_screen(const PipeSystem* ps, Point3D pos) {
+    return pos.x >= PIPE_RADIUS && pos.x < ps->width - PIPE_RADIUS &&
+           pos.y >= PIPE_RADIUS && pos.y < ps->height - PIPE_RADIUS &&
+           pos.z >= 0 && pos.z < GRID_DEPTH;
+}
+
+static void spawn_pipe(PipesContext* ctx) {
+    PipeSystem* ps = ctx->system;
+    if (ps->active_pipes >= ps->pipe_capacity) return;
+    
+    // Start over once the grid is too full for pipes to get anywhere; the
+    // framebuffer fades out the old pipes on its own
+    if (free_cells_occupancy_percent(&ps->free_cells) >= RECYCLE_OCCUPANCY) {
+        TRACE_INSTANT("recycle grid");
+        clear_grid(ps);
+    }
     
-    for (int i = 0; i < MAX_PIPES; i++) {
-        if (!pipe_system->pipes[i].active) {
-            // Random starting position on grid
-            int gx = rand() % (pipe_system->width / GRID_SIZE);
-            int gy = rand() % (pipe_system->height / GRID_SIZE);
-            int gz = 5 + rand() % 20;
+    for (int i = ps->first_free; i < ps->pipe_capacity; i++) {
+        if (!ps->pipes[i].active) {
+            // Random free starting position on grid
+            int cell = free_cells_pick(&ps->free_cells, next_random(ctx));
+            if (cell < 0) return;
             
-            if (!is_valid_position(gx, gy, gz)) continue;
+            int gz = cell % GRID_DEPTH;
+            int gy = (cell / GRID_DEPTH) % ps->grid_height;
+            int gx = cell / GRID_DEPTH / ps->grid_height;
             
-            pipe_system->pipes[i].pos.x = gx * GRID_SIZE + GRID_SIZE / 2;
-            pipe_system->pipes[i].pos.y = gy * GRID_SIZE + GRID_SIZE / 2;
-            pipe_system->pipes[i].pos.z = gz;
-            pipe_system->pipes[i].dir = rand() % 6;
-            pipe_system->pipes[i].color = rand() % 8;
-            pipe_system->pipes[i].active = 1;
-            pipe_system->pipes[i].length = 0;
+            ps->pipes[i].pos.x = gx * GRID_SIZE + GRID_SIZE / 2;
+            ps->pipes[i].pos.y = gy * GRID_SIZE + GRID_SIZE / 2;
+            ps->pipes[i].pos.z = gz;
+            ps->pipes[i].dir = next_random(ctx) % 6;
+            ps->pipes[i].color = next_random(ctx) % 8;
+            ps->pipes[i].active = 1;
+            ps->pipes[i].length = 0;
+            ps->pipes[i].random_state = pipe_seed(ctx->random_state, i);
+            record_spawn(ctx, &ps->pipes[i]);
             
             // Mark grid position as occupied
-            pipe_system->grid[gx][gy][gz] = 1;
-            pipe_system->active_pipes++;
+            claim_cell(ps, gx, gy, gz);
+            ps->active_pipes++;
+            ps->first_free = i + 1;
             break;
         }
     }
 }
 
-static void update_pipe(Pipe* pipe) {
+static void update_pipe(PipesContext* ctx, Pipe* pipe) {
     if (!pipe->active) return;
-    
-    Point3D old_pos = pipe->pos;
-    Point3D new_pos = pipe->pos;
+    TRACE_SCOPE("update_pipe");
+    PipeSystem* ps = ctx->system;
     
     // Move in current direction
-    switch (pipe->dir) {
-        case DIR_RIGHT: new_pos.x += SEGMENT_LENGTH; break;
-        case DIR_LEFT: new_pos.x -= SEGMENT_LENGTH; break;
-        case DIR_UP: new_pos.y -= SEGMENT_LENGTH; break;
-        case DIR_DOWN: new_pos.y += SEGMENT_LENGTH; break;
-        case DIR_FORWARD: new_pos.z += 1; break;
-        case DIR_BACKWARD: new_pos.z -= 1; break;
-    }
-    
-    // Check bounds
-    if (new_pos.x < PIPE_RADIUS || new_pos.x >= pipe_system->width - PIPE_RADIUS ||
-        new_pos.y < PIPE_RADIUS || new_pos.y >= pipe_system->height - PIPE_RADIUS ||
-        new_pos.z < 0 || new_pos.z >= 30) {
-        pipe->active = 0;
-        pipe_system->active_pipes--;
+    Point3D old_pos = pipe->pos;
+    Point3D new_pos = advance(pipe->pos, pipe->dir);
+    if (!inside_screen(ps, new_pos)) {
+        record_pipe(ctx, DRAW_EVENT_DIE, 0, pipe);
+        retire_pipe(ps, pipe);
         return;
     }
     
     // Draw pipe segment
     unsigned int color = pipe_colors[pipe->color % 8];
-    draw_cylinder_segment(old_pos, new_pos, PIPE_RADIUS, color);
+    record_pipe(ctx, DRAW_EVENT_SEGMENT, pipe->dir, pipe);
+    draw_cylinder_segment(ps, full_band(ps), old_pos, new_pos, PIPE_RADIUS, color);
     
-    // Update position
+    // Update position and mark the new grid position
     pipe->pos = new_pos;
     pipe->length++;
+    claim_cell(ps, new_pos.x / GRID_SIZE, new_pos.y / GRID_SIZE, new_pos.z);
     
-    // Mark new grid position
-    int gx = new_pos.x / GRID_SIZE;
-    int gy = new_pos.y / GRID_SIZE;
-    int gz = new_pos.z;
-    
-    if (gx >= 0 && gx < pipe_system->width / GRID_SIZE + 1 &&
-        gy >= 0 && gy < pipe_system->height / GRID_SIZE + 1 &&
-        gz >= 0 && gz < 30) {
-        pipe_system->grid[gx][gy][gz] = 1;
-    }
-    
-    // Randomly change direction
-    if (rand() % 100 < turn_probability || pipe->length % 5 == 0) {
-        Direction new_dir = get_new_direction(pipe->pos, pipe->dir);
+    // Change direction at random, every fifth segment, or when the cell
+    // ahead is taken or off screen
+    int blocked = !(neighbor_grid_free(&ps->grid, position_cell(ps, new_pos)) & (1u << pipe->dir));
+    if (blocked || next_random(ctx) % 100 < ctx->turn_probability || pipe->length % 5 == 0) {
+        Direction new_dir = get_new_direction(ps, &ctx->random_state, pipe->pos, pipe->dir);
         if (new_dir != -1 && new_dir != pipe->dir) {
-            draw_elbow(pipe->pos, pipe->dir, new_dir, PIPE_RADIUS, color);
+            record_pipe(ctx, DRAW_EVENT_ELBOW, new_dir, pipe);
+            draw_elbow(ps, full_band(ps), pipe->pos, pipe->dir, new_dir, PIPE_RADIUS, color);
             pipe->dir = new_dir;
         }
     }
     
     // Deactivate after max length
     if (pipe->length > MAX_PIPE_LENGTH) {
-        pipe->active = 0;
-        pipe_system->active_pipes--;
+        record_pipe(ctx, DRAW_EVENT_DIE, 0, pipe);
+        retire_pipe(ps, pipe);
     }
 }
 
-EMSCRIPTEN_KEEPALIVE
-void update_pipes() {
-    if (!pipe_system) return;
+// Phased stepping. Every pipe bids for the cell ahead if it is free, the
+// lowest index wins, and the others wait in their cell for a step; then the
+// moves are claimed, movers and waiters choose turns, and finally each worker
+// draws its band of the framebuffer. No two pipes ever share a cell. Phases
+// are separated by worker_pool_run()'s barrier and use only per-pipe random
+// streams, so the outcome does not depend on the number of workers or their
+// timing.
+
+typedef struct {
+    PipesContext* ctx;
+    PipeSystem* ps;
+} PhaseArgs;
+
+// Pipe slots [*begin, *end) handled by this worker
+static void phase_slice(const PipeSystem* ps, int worker, int workers, int* begin, int* end) {
+    *begin = (int)((long long)ps->pipe_capacity * worker / workers);
+    *end = (int)((long long)ps->pipe_capacity * (worker + 1) / workers);
+}
+
+static void phase_bid(void* arg, int worker, int workers) {
+    TRACE_SCOPE("phase bid");
+    PipeSystem* ps = ((PhaseArgs*)arg)->ps;
+    int begin, end;
+    phase_slice(ps, worker, workers, &begin, &end);
+    for (int i = begin; i < end; i++) {
+        Pipe* pipe = &ps->pipes[i];
+        if (!pipe->active) continue;
+        pipe->events = 0;
+        pipe->from = pipe->pos;
+        pipe->bid = -1;
+        
+        Point3D next = advance(pipe->pos, pipe->dir);
+        if (!inside_screen(ps, next)) {
+            pipe->events = PIPE_DIED;
+            continue;
+        }
+        
+        // A taken cell is not worth a bid, the turn phase finds another way
+        if (!(neighbor_grid_free(&ps->grid, position_cell(ps, pipe->pos)) & (1u << pipe->dir))) {
+            pipe->events = PIPE_WAITED;
+            continue;
+        }
+        
+        // Keep the lowest index bidding for the cell
+        pipe->bid = position_cell(ps, next);
+        unsigned int* slot = &ps->bids[pipe->bid];
+        unsigned int seen = __atomic_load_n(slot, __ATOMIC_RELAXED);
+        while ((unsigned int)i < seen &&
+               !__atomic_compare_exchange_n(slot, &seen, (unsigned int)i, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        }
+    }
+}
+
+// Only the winner of each bid moves, into a cell that was free
+static void phase_resolve(void* arg, int worker, int workers) {
+    TRACE_SCOPE("phase resolve");
+    PipeSystem* ps = ((PhaseArgs*)arg)->ps;
+    int begin, end;
+    phase_slice(ps, worker, workers, &begin, &end);
+    for (int i = begin; i < end; i++) {
+        Pipe* pipe = &ps->pipes[i];
+        if (!pipe->active || pipe->bid < 0) continue;
+        
+        if (ps->bids[pipe->bid] != (unsigned int)i) {
+            pipe->events = PIPE_WAITED;
+            continue;
+        }
+        pipe->pos = advance(pipe->pos, pipe->dir);
+        pipe->length++;
+        pipe->events |= PIPE_MOVED;
+    }
+}
+
+static void phase_claim(void* arg, int worker, int workers) {
+    TRACE_SCOPE("phase claim");
+    PipeSystem* ps = ((PhaseArgs*)arg)->ps;
+    int begin, end;
+    phase_slice(ps, worker, workers, &begin, &end);
+    for (int i = begin; i < end; i++) {
+        Pipe* pipe = &ps->pipes[i];
+        if (!(pipe->events & PIPE_MOVED)) continue;
+        neighbor_grid_claim_atomic(&ps->grid, pipe->pos.x / GRID_SIZE, pipe->pos.y / GRID_SIZE, pipe->pos.z);
+        __atomic_store_n(&ps->bids[pipe->bid], NO_BID, __ATOMIC_RELAXED);
+    }
+}
+
+static void phase_turn(void* arg, int worker, int workers) {
+    TRACE_SCOPE("phase turn");
+    PhaseArgs* phase = (PhaseArgs*)arg;
+    PipeSystem* ps = phase->ps;
+    int begin, end;
+    phase_slice(ps, worker, workers, &begin, &end);
+    for (int i = begin; i < end; i++) {
+        Pipe* pipe = &ps->pipes[i];
+        if (!(pipe->events & (PIPE_MOVED | PIPE_WAITED))) continue;
+        
+        // Waiters always look for another way, the cell ahead is taken now
+        int blocked = !(neighbor_grid_free(&ps->grid, position_cell(ps, pipe->pos)) & (1u << pipe->dir));
+        if (blocked || (pipe->events & PIPE_WAITED) ||
+            random_from(&pipe->random_state) % 100 < phase->ctx->turn_probability || pipe->length % 5 == 0) {
+            Direction new_dir = get_new_direction(ps, &pipe->random_state, pipe->pos, pipe->dir);
+            if (new_dir != -1 && new_dir != pipe->dir) {
+                pipe->dir = new_dir;
+                pipe->events |= PIPE_TURNED;
+            } else if (pipe->events & PIPE_WAITED) {
+                pipe->events |= PIPE_DIED; // Boxed in
+            }
+        }
+    }
+}
+
+// Every worker walks all pipes in index order but only writes its own rows,
+// so overlapping pipes stack the same way for any number of workers
+static void phase_draw(void* arg, int worker, int workers) {
+    TRACE_SCOPE("phase draw");
+    PipeSystem* ps = ((PhaseArgs*)arg)->ps;
+    Band band = { ps->height * worker / workers, ps->height * (worker + 1) / workers };
+    for (int i = 0; i < ps->pipe_capacity; i++) {
+        Pipe* pipe = &ps->pipes[i];
+        if (!(pipe->events & (PIPE_MOVED | PIPE_TURNED))) continue;
+        
+        int y0 = pipe->from.y - pipe->from.z / 2;
+        int y1 = pipe->pos.y - pipe->pos.z / 2;
+        if ((y0 > y1 ? y0 : y1) + MAX_STAMP_RADIUS < band.top ||
+            (y0 < y1 ? y0 : y1) - MAX_STAMP_RADIUS >= band.bottom) {
+            continue;
+        }
+        
+        unsigned int color = pipe_colors[pipe->color % 8];
+        if (pipe->events & PIPE_MOVED) {
+            draw_cylinder_segment(ps, band, pipe->from, pipe->pos, PIPE_RADIUS, color);
+        }
+        if (pipe->events & PIPE_TURNED) {
+            draw_elbow(ps, band, pipe->pos, pipe->dir, pipe->dir, PIPE_RADIUS, color);
+        }
+    }
+}
+
+static void phased_step(PipesContext* ctx) {
+    PipeSystem* ps = ctx->system;
+    PhaseArgs phase = { ctx, ps };
     
-    // Fade effect
-    for (int i = 0; i < pipe_system->width * pipe_system->height * 4; i += 4) {
-        for (int c = 0; c < 3; c++) {
-            if (pipe_system->framebuffer[i + c] > fade_speed) {
-                pipe_system->framebuffer[i + c] -= fade_speed;
-            } else {
-                pipe_system->framebuffer[i + c] = 0;
+    worker_pool_run(&ctx->workers, phase_bid, &phase);
+    worker_pool_run(&ctx->workers, phase_resolve, &phase);
+    worker_pool_run(&ctx->workers, phase_claim, &phase);
+    worker_pool_run(&ctx->workers, phase_turn, &phase);
+    
+    // Bookkeeping the workers cannot share. Events go out in the order
+    // phase_draw() draws, which a serial replay reproduces exactly.
+    for (int i = 0; i < ps->pipe_capacity; i++) {
+        Pipe* pipe = &ps->pipes[i];
+        if (!pipe->active) continue;
+        if (pipe->events & PIPE_MOVED) {
+            free_cells_claim(&ps->free_cells, position_cell(ps, pipe->pos));
+            if (ctx->record_events) {
+                record_pipe(ctx, DRAW_EVENT_SEGMENT, step_direction(pipe->from, pipe->pos), pipe);
             }
         }
+        if ((pipe->events & PIPE_TURNED) && ctx->record_events) {
+            record_pipe(ctx, DRAW_EVENT_ELBOW, pipe->dir, pipe);
+        }
+        if ((pipe->events & PIPE_DIED) || pipe->length > MAX_PIPE_LENGTH) {
+            record_pipe(ctx, DRAW_EVENT_DIE, 0, pipe);
+            retire_pipe(ps, pipe);
+        }
+    }
+    
+    worker_pool_run(&ctx->workers, phase_draw, &phase);
+    for (int i = 0; i < ps->pipe_capacity; i++) {
+        ps->pipes[i].events = 0;
+    }
+}
+
+// Saturating subtract of fade from the RGB channels, leaving alpha alone,
+// written to dst, which is either the framebuffer or a frame target the
+// image moves to in the same pass. SIMD builds handle four pixels per
+// instruction.
+static void fade_framebuffer(PipeSystem* ps, unsigned char* dst, int fade) {
+    const unsigned char* fb = ps->framebuffer;
+    int size = ps->width * ps->height * 4;
+    int i = 0;
+    
+    if (fade <= 0) {
+        if (dst != fb) memcpy(dst, fb, (size_t)size);
+        return;
     }
+    TRACE_SCOPE("fade");
     
-    // Update existing pipes
-    for (int i = 0; i < MAX_PIPES; i++) {
-        update_pipe(&pipe_system->pipes[i]);
+#if defined(__wasm_simd128__)
+    v128_t amount = wasm_u8x16_make(fade, fade, fade, 0, fade, fade, fade, 0,
+                                    fade, fade, fade, 0, fade, fade, fade, 0);
+    for (; i + 16 <= size; i += 16) {
+        v128_t pixels = wasm_v128_load(fb + i);
+        wasm_v128_store(dst + i, wasm_u8x16_sub_sat(pixels, amount));
     }
+#elif defined(__SSE2__)
+    __m128i amount = _mm_set1_epi32(fade * 0x010101);
+    for (; i + 16 <= size; i += 16) {
+        __m128i pixels = _mm_loadu_si128((const __m128i*)(fb + i));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_subs_epu8(pixels, amount));
+    }
+#endif
     
-    // Spawn new pipes
-    if (pipe_system->active_pipes < max_active_pipes && rand() % 100 < spawn_rate) {
-        spawn_pipe();
+    for (; i < size; i += 4) {
+        for (int c = 0; c < 3; c++) {
+            dst[i + c] = fb[i + c] > fade ? fb[i + c] - fade : 0;
+        }
+        dst[i + 3] = fb[i + 3];
+    }
+}
+
+// Full presentation: fade the image for a new frame, moving it to the frame
+// target if the caller set one
+static void fade_into_target(PipesContext* ctx, int fade) {
+    PipeSystem* ps = ctx->system;
+    unsigned char* target = ctx->frame_target ? ctx->frame_target : ps->framebuffer;
+    ctx->frame_target = NULL;
+    fade_framebuffer(ps, target, fade);
+    ps->framebuffer = target;
+}
+
+// Dirty presentation: make last frame's tiles transparent again, so the
+// framebuffer only ever holds what the current frame draws
+static void clear_dirty_tiles(PipeSystem* ps) {
+    TRACE_SCOPE("clear tiles");
+    for (int i = 0; i < ps->dirty_count; i++) {
+        int tile = ps->dirty_tiles[i];
+        int x = (tile % ps->tiles_x) << TILE_SHIFT;
+        int y = (tile / ps->tiles_x) << TILE_SHIFT;
+        int w = ps->width - x < PIPES_TILE_SIZE ? ps->width - x : PIPES_TILE_SIZE;
+        int h = ps->height - y < PIPES_TILE_SIZE ? ps->height - y : PIPES_TILE_SIZE;
+        for (int row = y; row < y + h; row++) {
+            memset(ps->framebuffer + ((size_t)row * ps->width + x) * 4, 0, (size_t)w * 4);
+        }
+        ps->tile_marks[tile] = 0;
+    }
+    ps->dirty_count = 0;
+}
+
+static void collect_dirty_tiles(PipeSystem* ps) {
+    int tiles = ps->tiles_x * ps->tiles_y;
+    ps->dirty_count = 0;
+    for (int tile = 0; tile < tiles; tile++) {
+        if (ps->tile_marks[tile]) ps->dirty_tiles[ps->dirty_count++] = tile;
+    }
+}
+
+// Account for a frame's fade. Returns 0 when the image is already black,
+// in which case the fade has nothing to do and frame_fade says so.
+static int apply_glow(PipesContext* ctx, int fade) {
+    int faded = ctx->glow > 0 && fade > 0;
+    ctx->frame_fade = faded ? fade : 0;
+    ctx->glow = ctx->glow > fade ? ctx->glow - fade : 0;
+    return faded;
+}
+
+static void finish_frame_state(PipesContext* ctx, int faded, int drew) {
+    if (drew) ctx->glow = 255;
+    ctx->frame_state = (!faded && !drew ? PIPES_FRAME_UNCHANGED : 0) |
+                       (ctx->glow == 0 && ctx->system->active_pipes == 0 ? PIPES_FRAME_BLACK : 0);
+}
+
+// Apply parameter changes queued by JS since the last frame
+static void drain_commands(PipesContext* ctx) {
+    Command cmd;
+    while (command_ring_pop(&ctx->command_ring, &cmd)) {
+        switch (cmd.type) {
+            case CMD_SET_FADE_SPEED: pipes_set_fade_speed(ctx, cmd.a); break;
+            case CMD_SET_SPAWN_RATE: pipes_set_spawn_rate(ctx, cmd.a); break;
+            case CMD_SET_TURN_PROBABILITY: pipes_set_turn_probability(ctx, cmd.a); break;
+            case CMD_SET_MAX_PIPES: pipes_set_max_pipes(ctx, cmd.a); break;
+            case CMD_SET_ANIMATION_SPEED: pipes_set_animation_speed(ctx, cmd.a); break;
+            case CMD_SET_STEPS_PER_FRAME: pipes_set_steps_per_frame(ctx, cmd.a); break;
+            default: break;
+        }
     }
 }
 
 EMSCRIPTEN_KEEPALIVE
-void cleanup_pipes() {
-    if (pipe_system) {
-        if (pipe_system->grid) {
-            int grid_width = pipe_system->width / GRID_SIZE + 1;
-            int grid_height = pipe_system->height / GRID_SIZE + 1;
-            for (int x = 0; x < grid_width; x++) {
-                for (int y = 0; y < grid_height; y++) {
-                    free(pipe_system->grid[x][y]);
-                }
-                free(pipe_system->grid[x]);
+void pipes_update(PipesContext* ctx) {
+    PipeSystem* ps = ctx->system;
+    if (!ps) return;
+    TRACE_SCOPE("frame");
+    
+    drain_commands(ctx);
+    
+    // Fade effect, once per frame for all of its steps. Segments drawn by
+    // earlier steps of a turbo frame are not faded relative to later ones.
+    // Dirty presentation hands it to the caller along with the new pixels.
+    // Fading a black image changes nothing and is skipped.
+    int fade = ctx->fade_speed * ctx->steps_per_frame;
+    if (fade > 255) fade = 255;
+    if (fade < 0) fade = 0;
+    int faded = apply_glow(ctx, fade);
+    if (ps->tile_marks) {
+        clear_dirty_tiles(ps);
+    } else {
+        fade_into_target(ctx, faded ? fade : 0);
+    }
+    int drew = 0;
+    
+    // Pipes live for about MAX_PIPE_LENGTH steps, so large pools need several
+    // spawn chances per step to stay populated
+    int spawns = (ctx->max_active_pipes + MAX_PIPE_LENGTH - 1) / MAX_PIPE_LENGTH;
+    if (spawns < 1) spawns = 1;
+    
+    for (int step = 0; step < ctx->steps_per_frame; step++) {
+        // Every live pipe draws a segment
+        drew |= ps->active_pipes > 0;
+        
+        // Update existing pipes
+        if (ps->bids) {
+            phased_step(ctx);
+        } else {
+            for (int i = 0; i < ps->pipe_capacity; i++) {
+                update_pipe(ctx, &ps->pipes[i]);
+            }
+        }
+        
+        // Spawn new pipes
+        for (int n = 0; n < spawns; n++) {
+            if (ps->active_pipes < ctx->max_active_pipes && next_random(ctx) % 100 < ctx->spawn_rate) {
+                spawn_pipe(ctx);
+            }
+        }
+    }
+    
+    if (ps->tile_marks) collect_dirty_tiles(ps);
+    finish_frame_state(ctx, faded, drew);
+    if (ctx->record_events) {
+        unsigned int frame_fade = (unsigned int)fade;
+        draw_events_put(&ctx->events, DRAW_EVENT_FRAME, 0, 1, &frame_fade);
+    }
+}
+
+static void replay_event(PipesContext* ctx, const DrawEvent* event) {
+    if (event->type == DRAW_EVENT_RESET) {
+        if (event->arg != DRAW_EVENTS_SOFTWARE || event->count < 3 ||
+            event->values[0] > 0xFFFF || event->values[1] > 0xFFFF) {
+            return;
+        }
+        pipes_set_pipe_capacity(ctx, (int)event->values[2]);
+        pipes_init(ctx, (int)event->values[0], (int)event->values[1]);
+        return;
+    }
+    
+    PipeSystem* ps = ctx->system;
+    if (!ps) return;
+    
+    // The rest act on one pipe
+    if (event->type < DRAW_EVENT_SPAWN || event->type > DRAW_EVENT_DIE ||
+        event->values[0] >= (unsigned int)ps->pipe_capacity || event->arg > DIR_BACKWARD) {
+        return;
+    }
+    Pipe* pipe = &ps->pipes[event->values[0]];
+    Direction dir = (Direction)event->arg;
+    unsigned int color = pipe_colors[pipe->color % 8];
+    switch (event->type) {
+        case DRAW_EVENT_SPAWN:
+            if (event->values[1] >= (unsigned int)ps->grid_width || event->values[2] >= (unsigned int)ps->grid_height ||
+                event->values[3] >= GRID_DEPTH) {
+                return;
             }
-            free(pipe_system->grid);
+            pipe->pos.x = (int)event->values[1] * GRID_SIZE + GRID_SIZE / 2;
+            pipe->pos.y = (int)event->values[2] * GRID_SIZE + GRID_SIZE / 2;
+            pipe->pos.z = (int)event->values[3];
+            pipe->dir = dir;
+            pipe->color = (int)(event->values[4] % 8);
+            if (!pipe->active) ps->active_pipes++;
+            pipe->active = 1;
+            break;
+        case DRAW_EVENT_SEGMENT: {
+            Point3D to = advance(pipe->pos, dir);
+            draw_cylinder_segment(ps, full_band(ps), pipe->pos, to, PIPE_RADIUS, color);
+            pipe->pos = to;
+            pipe->dir = dir;
+            break;
+        }
+        case DRAW_EVENT_ELBOW:
+            draw_elbow(ps, full_band(ps), pipe->pos, pipe->dir, dir, PIPE_RADIUS, color);
+            pipe->dir = dir;
+            break;
+        case DRAW_EVENT_DIE:
+            if (pipe->active) ps->active_pipes--;
+            pipe->active = 0;
+            break;
+    }
+}
+
+// Draw the next frame of a stream recorded with pipes_set_event_recording()
+// instead of simulating, and present it like a pipes_update(). Returns the
+// bytes used, 0 until a whole frame has arrived; the caller keeps the rest
+// and appends to it. Streams start at a RESET, which sizes the framebuffer
+// and pipe table to the recorder's.
+EMSCRIPTEN_KEEPALIVE
+unsigned int pipes_replay(PipesContext* ctx, const unsigned char* data, unsigned int size) {
+    DrawEvent event;
+    size_t end = draw_events_frame_size(data, size, &event);
+    if (!end) return 0;
+    TRACE_SCOPE("replay");
+    int fade = event.values[0] > 255 ? 255 : (int)event.values[0];
+    
+    ctx->frame_fade = 0;
+    if (ctx->system && ctx->system->tile_marks) clear_dirty_tiles(ctx->system);
+    
+    // Events before the first draw were logged between frames, so the
+    // recorder faded after them
+    int passed = 0;
+    int faded = 0;
+    int drew = 0;
+    for (size_t pos = 0; pos < end;) {
+        size_t start = pos;
+        if (draw_events_next(data, end, &pos, &event) < 0) {
+            pos = start + 1;
+            continue;
         }
-        if (pipe_system->framebuffer) {
-            free(pipe_system->framebuffer);
+        int draws = event.type == DRAW_EVENT_SEGMENT || event.type == DRAW_EVENT_ELBOW;
+        if (!passed && ctx->system && (draws || event.type == DRAW_EVENT_FRAME)) {
+            faded = apply_glow(ctx, fade);
+            if (!ctx->system->tile_marks) fade_into_target(ctx, faded ? fade : 0);
+            passed = 1;
         }
-        free(pipe_system);
-        pipe_system = NULL;
+        drew |= draws;
+        replay_event(ctx, &event);
     }
-}
\ No newline at end of file
+    
+    if (ctx->system && ctx->system->tile_marks) collect_dirty_tiles(ctx->system);
+    if (ctx->system) finish_frame_state(ctx, faded, drew);
+    return (unsigned int)end;
+}
+
+EMSCRIPTEN_KEEPALIVE
+void pipes_cleanup(PipesContext* ctx) {
+    arena_destroy(&ctx->arena);
+    ctx->system = NULL;
+    memset(&ctx->memory_usage, 0, sizeof(ctx->memory_usage));
+}
+
+#define SNAPSHOT_MAGIC 0x32504950 // "PIP2"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_PIPE_BYTES 8
+
+// Snapshot layout, little-endian:
+//   u32 magic, u16 version, u16 flags, u16 width, u16 height, u32 random state
+//   u16 pipe count, then per active pipe: u16 x, u16 y, u8 z, dir, color, length
+//   grid occupancy, one bit per cell in cell_index() order
+//   if PIPES_SNAPSHOT_FRAMEBUFFER: run-length encoded RGB framebuffer
+EMSCRIPTEN_KEEPALIVE
+unsigned int pipes_snapshot_max_size(PipesContext* ctx, int flags) {
+    PipeSystem* ps = ctx->system;
+    if (!ps) return 0;
+    
+    size_t size = 18 + (size_t)ps->pipe_capacity * SNAPSHOT_PIPE_BYTES +
+                  snapshot_bits_size(ps->free_cells.total);
+    if (flags & PIPES_SNAPSHOT_FRAMEBUFFER) {
+        size += snapshot_rle_max_size(ps->width * ps->height);
+    }
+    return (unsigned int)size;
+}
+
+EMSCRIPTEN_KEEPALIVE
+void pipes_set_snapshot_image(PipesContext* ctx, const unsigned char* pixels) {
+    ctx->snapshot_image = pixels;
+}
+
+EMSCRIPTEN_KEEPALIVE
+unsigned int pipes_snapshot(PipesContext* ctx, unsigned char* data, unsigned int size, int flags) {
+    PipeSystem* ps = ctx->system;
+    if (!ps || ps->width > 0xFFFF || ps->height > 0xFFFF || ps->active_pipes > 0xFFFF) return 0;
+    
+    // Under dirty presentation the image is kept by the caller, who hands
+    // it in for the snapshot; without it there is none to save
+    const unsigned char* image = ps->tile_marks ? ctx->snapshot_image : ps->framebuffer;
+    ctx->snapshot_image = NULL;
+    flags &= PIPES_SNAPSHOT_FRAMEBUFFER;
+    if (!image) flags = 0;
+    SnapshotWriter w = snapshot_writer(data, size);
+    snapshot_put_u32(&w, SNAPSHOT_MAGIC);
+    snapshot_put_u16(&w, SNAPSHOT_VERSION);
+    snapshot_put_u16(&w, flags);
+    snapshot_put_u16(&w, ps->width);
+    snapshot_put_u16(&w, ps->height);
+    snapshot_put_u32(&w, ctx->random_state);
+    
+    snapshot_put_u16(&w, ps->active_pipes);
+    for (int i = 0; i < ps->pipe_capacity; i++) {
+        const Pipe* pipe = &ps->pipes[i];
+        if (!pipe->active) continue;
+        snapshot_put_u16(&w, pipe->pos.x);
+        snapshot_put_u16(&w, pipe->pos.y);
+        snapshot_put_u8(&w, pipe->pos.z);
+        snapshot_put_u8(&w, pipe->dir);
+        snapshot_put_u8(&w, pipe->color);
+        snapshot_put_u8(&w, pipe->length);
+    }
+    
+    snapshot_put_bits(&w, ps->grid.cells, ps->free_cells.total, NEIGHBOR_OCCUPIED);
+    if (flags & PIPES_SNAPSHOT_FRAMEBUFFER) {
+        snapshot_put_rle_rgb(&w, image, ps->width * ps->height);
+    }
+    return w.ok ? (unsigned int)w.pos : 0;
+}
+
+// Restore a snapshot taken at the current framebuffer size. Returns 0 if it
+// does not match or is damaged, in which case the scene restarts empty.
+EMSCRIPTEN_KEEPALIVE
+int pipes_restore(PipesContext* ctx, const unsigned char* data, unsigned int size) {
+    PipeSystem* ps = ctx->system;
+    if (!ps) return 0;
+    
+    SnapshotReader r = snapshot_reader(data, size);
+    int valid = snapshot_get_u32(&r) == SNAPSHOT_MAGIC &&
+                snapshot_get_u16(&r) == SNAPSHOT_VERSION;
+    int flags = snapshot_get_u16(&r);
+    valid = valid && (int)snapshot_get_u16(&r) == ps->width;
+    valid = valid && (int)snapshot_get_u16(&r) == ps->height;
+    unsigned int random_state = snapshot_get_u32(&r);
+    int count = snapshot_get_u16(&r);
+    valid = valid && r.ok && random_state != 0 && count <= ps->pipe_capacity;
+    if (!valid) return 0;
+    
+    memset(ps->pipes, 0, (size_t)ps->pipe_capacity * sizeof(Pipe));
+    for (int i = 0; i < count && r.ok; i++) {
+        Pipe* pipe = &ps->pipes[i];
+        pipe->pos.x = snapshot_get_u16(&r);
+        pipe->pos.y = snapshot_get_u16(&r);
+        pipe->pos.z = snapshot_get_u8(&r);
+        pipe->dir = snapshot_get_u8(&r);
+        pipe->color = snapshot_get_u8(&r);
+        pipe->length = snapshot_get_u8(&r);
+        pipe->active = 1;
+        
+        if (pipe->pos.x >= ps->width || pipe->pos.y >= ps->height || pipe->pos.z >= GRID_DEPTH ||
+            pipe->dir > DIR_BACKWARD || pipe->color >= 8 || pipe->length > MAX_PIPE_LENGTH) {
+            r.ok = 0;
+        }
+    }
+    ps->active_pipes = count;
+    ps->first_free = count;
+    
+    // The free-cell index is derived from the grid rather than stored
+    snapshot_get_bits(&r, ps->grid.cells, ps->free_cells.total);
+    sync_grid(ps);
+    
+    if (flags & PIPES_SNAPSHOT_FRAMEBUFFER) {
+        snapshot_get_rle_rgb(&r, ps->framebuffer, ps->width * ps->height);
+    }
+    
+    if (!r.ok) {
+        pipes_init(ctx, ps->width, ps->height);
+        return 0;
+    }
+    ctx->random_state = random_state;
+    for (int i = 0; i < count; i++) {
+        ps->pipes[i].random_state = pipe_seed(random_state, i);
+    }
+    record_scene(ctx);
+    
+    // Under dirty presentation a restored image goes out as a frame with
+    // every tile dirty; without one the caller keeps the image it has
+    ctx->frame_fade = 0;
+    ctx->glow = 255;
+    ctx->frame_state = 0;
+    if (ps->tile_marks) {
+        if (flags & PIPES_SNAPSHOT_FRAMEBUFFER) {
+            memset(ps->tile_marks, 1, (size_t)ps->tiles_x * ps->tiles_y);
+            collect_dirty_tiles(ps);
+        } else {
+            clear_dirty_tiles(ps);
+        }
+    }
+    return 1;
+}
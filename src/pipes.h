@@ -0,0 +1,120 @@
+#ifndef PIPES_H
+#define PIPES_H
+
+#include <stdint.h>
+#include "command_ring.h"
+
+// Public API of the software engine (src/pipes.c). Every instance lives in
+// its own context, so one module can drive any number of screens from one
+// heap. Contexts are independent and must each be used from one thread at
+// a time.
+
+typedef struct PipesContext PipesContext;
+
+// Bytes taken by each buffer of an instance, see pipes_get_memory_usage().
+// Layout must match readMemoryUsage() in src/lib/Screensaver.svelte.
+typedef struct {
+    uint32_t arena_capacity; // Size of the arena block, may exceed arena_used
+    uint32_t arena_used; // Sum of the buffers below
+    uint32_t system;
+    uint32_t pipes;
+    uint32_t framebuffer;
+    uint32_t grid;
+    uint32_t free_cells;
+} MemoryUsage;
+
+// Returns NULL if out of memory. Tunables start at their defaults and keep
+// their values across pipes_init() calls.
+PipesContext* pipes_create(void);
+void pipes_destroy(PipesContext* ctx);
+
+// (Re)start the animation on a width x height framebuffer
+void pipes_init(PipesContext* ctx, int width, int height);
+void pipes_update(PipesContext* ctx);
+unsigned char* pipes_get_framebuffer(PipesContext* ctx);
+// Framebuffer size, 0 before pipes_init(); replay sets it from the stream
+int pipes_get_width(PipesContext* ctx);
+int pipes_get_height(PipesContext* ctx);
+// Release the buffers but keep the context and its settings
+void pipes_cleanup(PipesContext* ctx);
+
+void pipes_set_fade_speed(PipesContext* ctx, int speed);
+void pipes_set_spawn_rate(PipesContext* ctx, int rate);
+void pipes_set_turn_probability(PipesContext* ctx, int prob);
+void pipes_set_max_pipes(PipesContext* ctx, int max);
+void pipes_set_animation_speed(PipesContext* ctx, int fps);
+void pipes_set_pipe_capacity(PipesContext* ctx, int capacity);
+void pipes_set_steps_per_frame(PipesContext* ctx, int steps);
+// Phased stepping on this many threads, 0 for serial; see pipes.c
+void pipes_set_worker_threads(PipesContext* ctx, int threads);
+
+// Presentation modes, applied by pipes_init(). PIPES_PRESENT_FULL fades the
+// framebuffer on the CPU every frame and it always holds the whole image.
+// Under PIPES_PRESENT_DIRTY the framebuffer only holds what the last
+// pipes_update() drew, opaque, on transparent black, and the caller keeps
+// the image: each frame it fades its copy by pipes_get_frame_fade() / 255
+// per channel and lays the opaque pixels of the dirty tiles on top. Tiles
+// are PIPES_TILE_SIZE pixels square, numbered row by row, and listed in
+// ascending order. CPU cost then follows pipe activity, not screen size.
+#define PIPES_PRESENT_FULL 0
+#define PIPES_PRESENT_DIRTY 1
+#define PIPES_TILE_SIZE 64
+void pipes_set_present_mode(PipesContext* ctx, int mode);
+// Fade of the last frame, 0 when the image was already black
+int pipes_get_frame_fade(PipesContext* ctx);
+int pipes_get_dirty_tile_count(PipesContext* ctx);
+int* pipes_get_dirty_tiles(PipesContext* ctx);
+
+// What the last pipes_update() or pipes_replay() did, so callers can skip
+// presenting and slow down while nothing happens. PIPES_FRAME_UNCHANGED:
+// the image is the same as after the previous frame, nothing was drawn or
+// faded. PIPES_FRAME_BLACK: the image is black and no pipe is live, so
+// only a spawn can change it. Spawns are rolled once per frame, so a caller
+// that ticks slower while black still runs every frame it skipped; they are
+// nearly free then. Frames after pipes_init() or pipes_restore() count as
+// changed.
+#define PIPES_FRAME_UNCHANGED 1
+#define PIPES_FRAME_BLACK 2
+int pipes_get_frame_state(PipesContext* ctx);
+
+// Native hosts that hand frames to another process: the next pipes_update()
+// or pipes_replay() draws into pixels, width x height RGBA like the
+// framebuffer, and pipes_get_framebuffer() returns it from then on. The image
+// moves over in the frame's fade pass, so switching targets every frame costs
+// no extra copy. pixels must stay valid until the next target is set;
+// pipes_init() goes back to the engine's own framebuffer. Full presentation
+// only, returns 0 under PIPES_PRESENT_DIRTY or before pipes_init().
+int pipes_set_frame_target(PipesContext* ctx, unsigned char* pixels);
+
+// Draw-event streams (src/draw_events.h): one recording instance drives any
+// number of displays. The recorder logs spawns, segments, elbows and deaths
+// as a few bytes each; the caller ships pipes_get_events() bytes, then calls
+// pipes_clear_events(). A display feeds whatever arrived to pipes_replay(),
+// which draws one whole frame per call without simulating and returns the
+// bytes it used, 0 while the next frame is incomplete. Replay is exact from
+// the recorder's RESET on, which goes out with every pipes_init() and when
+// recording starts.
+void pipes_set_event_recording(PipesContext* ctx, int enabled);
+unsigned char* pipes_get_events(PipesContext* ctx);
+unsigned int pipes_get_event_size(PipesContext* ctx);
+void pipes_clear_events(PipesContext* ctx);
+unsigned int pipes_replay(PipesContext* ctx, const unsigned char* data, unsigned int size);
+
+CommandRing* pipes_get_command_ring(PipesContext* ctx);
+MemoryUsage* pipes_get_memory_usage(PipesContext* ctx);
+unsigned int pipes_get_memory_required(PipesContext* ctx, int width, int height);
+int pipes_reserve_memory(PipesContext* ctx, int width, int height);
+
+// Compact scene snapshots for warm restarts: grid occupancy, active pipes,
+// random state and, with PIPES_SNAPSHOT_FRAMEBUFFER, the current image.
+// pipes_snapshot() returns the bytes written, 0 if data is too small.
+#define PIPES_SNAPSHOT_FRAMEBUFFER 1
+unsigned int pipes_snapshot_max_size(PipesContext* ctx, int flags);
+unsigned int pipes_snapshot(PipesContext* ctx, unsigned char* data, unsigned int size, int flags);
+// Under PIPES_PRESENT_DIRTY the image is the caller's: hand it in, width x
+// height RGBA with the top row first, before each pipes_snapshot() that
+// should carry it. Without it the snapshot has no image.
+void pipes_set_snapshot_image(PipesContext* ctx, const unsigned char* pixels);
+int pipes_restore(PipesContext* ctx, const unsigned char* data, unsigned int size);
+
+#endif
@@ -1,12 +1,21 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#ifdef __EMSCRIPTEN__
 #include <emscripten/emscripten.h>
+#else
+#define EMSCRIPTEN_KEEPALIVE
+#endif
 #include <raylib.h>
+#include "draw_events.h"
+#include "free_cells.h"
+#include "trace.h"
 
-#define GRID_WIDTH 80
-#define GRID_HEIGHT 60
+#define DEFAULT_CELL_SIZE 10
+#define MIN_CELL_SIZE 4
 #define PIPE_SEGMENTS 5
+#define MAX_STEPS_PER_FRAME 10000
+#define RECYCLE_OCCUPANCY 85 // Percent of cells claimed before the grid is cleared
 #define MAX_COLORS 7
 
 typedef enum {
@@ -23,7 +32,8 @@ typedef enum {
     PIPE_CORNER_TL = 3,
     PIPE_CORNER_TR = 4,
     PIPE_CORNER_BR = 5,
-    PIPE_CORNER_BL = 6
+    PIPE_CORNER_BL = 6,
+    PIPE_TYPE_COUNT = 7
 } PipeType;
 
 typedef struct {
@@ -39,14 +49,29 @@ typedef struct {
     int steps;
 } Pipe;
 
-static Cell grid[GRID_HEIGHT][GRID_WIDTH];
+static Cell *grid = NULL; // gridHeight rows of gridWidth cells
+static int gridWidth = 0;
+static int gridHeight = 0;
+static FreeCells freeCells; // Cells neither placed nor under a pipe head
 static Pipe pipes[10];
 static int numPipes = 0;
-static int cellSize = 10;
+static int targetCellSize = DEFAULT_CELL_SIZE;
+static int cellSize = DEFAULT_CELL_SIZE;
 static int speed = 30;
 static int thickness = 3;
 static int frameCounter = 0;
+static int stepsPerFrame = 1;   // Turbo multiplier on top of speed
+static int stepAccumulator = 0; // Step budget carried between frames, in 1/60 steps
 static Color pipeColors[MAX_COLORS];
+static RenderTexture2D canvas; // Every placed cell, drawn once
+static int canvasDirty = 1;    // Cell layout changed, redraw the whole grid
+static Texture2D atlas;        // One white tile per PipeType, tinted when drawn
+static int atlasCellSize = 0;  // Layout the atlas was built for
+static int atlasThickness = 0;
+static DrawEventLog events;    // Draw-event recording, see src/draw_events.h
+static int recordEvents = 0;
+static int replaying = 0;      // Driven by pipes2d_replayFrame(), the stream owns the grid
+static unsigned char stepped[10]; // Replay: pipes that placed a cell this step
 
 static Direction getRandomDirection() {
     return (Direction)(rand() % 4);
@@ -61,8 +86,8 @@ static void tryAddDirection(Direction dirs[], int *count, Direction dir, int x,
         case DIR_LEFT:  nx--; break;
     }
     
-    if (nx >= 0 && nx < GRID_WIDTH && ny >= 0 && ny < GRID_HEIGHT && 
-        grid[ny][nx].type == PIPE_NONE) {
+    if (nx >= 0 && nx < gridWidth && ny >= 0 && ny < gridHeight && 
+        grid[ny * gridWidth + nx].type == PIPE_NONE) {
         dirs[(*count)++] = dir;
     }
 }
@@ -91,6 +116,36 @@ static Direction chooseNewDirection(int x, int y, Direction currentDir) {
     return possibleDirs[rand() % dirCount];
 }
 
+// Waiting for a free cell, see initPipe()
+static int pipeParked(const Pipe *pipe) {
+    return pipe->x < 0;
+}
+
+// SPAWN carries the steps toward the next cell in place of a depth
+static void recordSpawn(const Pipe *pipe) {
+    if (recordEvents) {
+        draw_events_spawn(&events, (int)(pipe - pipes), pipe->dir, pipe->x, pipe->y, pipe->steps, pipe->color);
+    }
+}
+
+// A RESET with every placed cell and the pipes, where a display can join
+static void recordScene() {
+    if (!recordEvents || !grid) return;
+    unsigned int layout[4] = { gridWidth, gridHeight, cellSize, thickness };
+    draw_events_put(&events, DRAW_EVENT_RESET, DRAW_EVENTS_FLAT, 4, layout);
+    for (int y = 0; y < gridHeight; y++) {
+        for (int x = 0; x < gridWidth; x++) {
+            Cell cell = grid[y * gridWidth + x];
+            if (cell.type == PIPE_NONE) continue;
+            unsigned int values[4] = { x, y, 0, cell.color };
+            draw_events_put(&events, DRAW_EVENT_CELL, cell.type, 4, values);
+        }
+    }
+    for (int i = 0; i < numPipes; i++) {
+        if (!pipeParked(&pipes[i])) recordSpawn(&pipes[i]);
+    }
+}
+
 static PipeType getPipeType(Direction from, Direction to) {
     if ((from == DIR_UP && to == DIR_DOWN) || (from == DIR_DOWN && to == DIR_UP)) {
         return PIPE_VERTICAL;
@@ -115,83 +170,170 @@ static PipeType getPipeType(Direction from, Direction to) {
     return PIPE_HORIZONTAL;
 }
 
+// Free the whole grid except the cells pipes are currently in. A pipe that
+// just left the grid is respawned right after and holds no cell.
+static void clearGrid() {
+    memset(grid, 0, gridWidth * gridHeight * sizeof(Cell));
+    free_cells_reset(&freeCells);
+    for (int i = 0; i < numPipes; i++) {
+        if (pipes[i].x < 0 || pipes[i].x >= gridWidth || pipes[i].y < 0 || pipes[i].y >= gridHeight) continue;
+        free_cells_claim(&freeCells, pipes[i].y * gridWidth + pipes[i].x);
+    }
+    canvasDirty = 1;
+    if (recordEvents) draw_events_put(&events, DRAW_EVENT_CLEAR, 0, 0, NULL);
+}
+
 static void initPipe(Pipe *pipe) {
-    pipe->x = rand() % GRID_WIDTH;
-    pipe->y = rand() % GRID_HEIGHT;
+    // Start over once the grid is too full for new pipes to get anywhere
+    if (free_cells_occupancy_percent(&freeCells) >= RECYCLE_OCCUPANCY) {
+        clearGrid();
+    }
+    
+    int cell = free_cells_pick(&freeCells, rand());
+    if (cell < 0) {
+        clearGrid();
+        cell = free_cells_pick(&freeCells, rand());
+    }
+    if (cell < 0) {
+        // Every cell is under another pipe's head, which only happens on a
+        // grid smaller than the pipe count. Wait and retry on the next step.
+        pipe->x = -1;
+        pipe->y = -1;
+        return;
+    }
+    free_cells_claim(&freeCells, cell);
+    
+    pipe->x = cell % gridWidth;
+    pipe->y = cell / gridWidth;
     pipe->dir = getRandomDirection();
     pipe->color = rand() % MAX_COLORS;
     pipe->steps = 0;
+    recordSpawn(pipe);
 }
 
-static void updatePipe(Pipe *pipe) {
-    if (pipe->steps >= PIPE_SEGMENTS) {
-        Direction newDir = chooseNewDirection(pipe->x, pipe->y, pipe->dir);
-        Direction from = (Direction)((pipe->dir + 2) % 4);
-        
-        grid[pipe->y][pipe->x].type = getPipeType(from, newDir);
-        grid[pipe->y][pipe->x].color = pipe->color;
-        
-        switch (pipe->dir) {
-            case DIR_UP:    pipe->y--; break;
-            case DIR_RIGHT: pipe->x++; break;
-            case DIR_DOWN:  pipe->y++; break;
-            case DIR_LEFT:  pipe->x--; break;
-        }
-        
-        if (pipe->x < 0 || pipe->x >= GRID_WIDTH || 
-            pipe->y < 0 || pipe->y >= GRID_HEIGHT || 
-            grid[pipe->y][pipe->x].type != PIPE_NONE) {
-            initPipe(pipe);
-        } else {
-            pipe->dir = newDir;
-            pipe->steps = 0;
-        }
-    } else {
-        pipe->steps++;
-    }
-}
-
-static void drawPipeSegment(int x, int y, PipeType type, Color color, int offset) {
-    int cx = x * cellSize + cellSize / 2;
-    int cy = y * cellSize + cellSize / 2;
+// Draw the white shape of a pipe type into the atlas tile at (ox, oy)
+static void drawPipeShape(Image *image, int ox, int oy, PipeType type) {
+    int cx = ox + cellSize / 2;
+    int cy = oy + cellSize / 2;
     int halfThick = thickness / 2;
     
     switch (type) {
         case PIPE_HORIZONTAL:
-            DrawRectangle(x * cellSize, cy - halfThick, cellSize, thickness, color);
+            ImageDrawRectangle(image, ox, cy - halfThick, cellSize, thickness, WHITE);
             break;
             
         case PIPE_VERTICAL:
-            DrawRectangle(cx - halfThick, y * cellSize, thickness, cellSize, color);
+            ImageDrawRectangle(image, cx - halfThick, oy, thickness, cellSize, WHITE);
             break;
             
         case PIPE_CORNER_TL:
-            DrawRectangle(cx - halfThick, y * cellSize, thickness, cellSize/2 + halfThick, color);
-            DrawRectangle(cx - halfThick, cy - halfThick, cellSize/2 + halfThick, thickness, color);
+            ImageDrawRectangle(image, cx - halfThick, oy, thickness, cellSize/2 + halfThick, WHITE);
+            ImageDrawRectangle(image, cx - halfThick, cy - halfThick, cellSize/2 + halfThick, thickness, WHITE);
             break;
             
         case PIPE_CORNER_TR:
-            DrawRectangle(cx - halfThick, y * cellSize, thickness, cellSize/2 + halfThick, color);
-            DrawRectangle(x * cellSize, cy - halfThick, cellSize/2 + halfThick, thickness, color);
+            ImageDrawRectangle(image, cx - halfThick, oy, thickness, cellSize/2 + halfThick, WHITE);
+            ImageDrawRectangle(image, ox, cy - halfThick, cellSize/2 + halfThick, thickness, WHITE);
             break;
             
         case PIPE_CORNER_BR:
-            DrawRectangle(cx - halfThick, cy - halfThick, thickness, cellSize/2 + halfThick, color);
-            DrawRectangle(x * cellSize, cy - halfThick, cellSize/2 + halfThick, thickness, color);
+            ImageDrawRectangle(image, cx - halfThick, cy - halfThick, thickness, cellSize/2 + halfThick, WHITE);
+            ImageDrawRectangle(image, ox, cy - halfThick, cellSize/2 + halfThick, thickness, WHITE);
             break;
             
         case PIPE_CORNER_BL:
-            DrawRectangle(cx - halfThick, cy - halfThick, thickness, cellSize/2 + halfThick, color);
-            DrawRectangle(cx - halfThick, cy - halfThick, cellSize/2 + halfThick, thickness, color);
+            ImageDrawRectangle(image, cx - halfThick, cy - halfThick, thickness, cellSize/2 + halfThick, WHITE);
+            ImageDrawRectangle(image, cx - halfThick, cy - halfThick, cellSize/2 + halfThick, thickness, WHITE);
             break;
             
         case PIPE_NONE:
         default:
-            // Do nothing for empty cells
+            // Empty tile
             break;
     }
 }
 
+// Only the tile size and line thickness change the shapes
+static void buildAtlas() {
+    if (atlas.id != 0 && atlasCellSize == cellSize && atlasThickness == thickness) return;
+    
+    Image image = GenImageColor(PIPE_TYPE_COUNT * cellSize, cellSize, BLANK);
+    for (int type = PIPE_HORIZONTAL; type < PIPE_TYPE_COUNT; type++) {
+        drawPipeShape(&image, type * cellSize, 0, (PipeType)type);
+    }
+    
+    if (atlas.id != 0) {
+        UnloadTexture(atlas);
+    }
+    atlas = LoadTextureFromImage(image);
+    UnloadImage(image);
+    atlasCellSize = cellSize;
+    atlasThickness = thickness;
+}
+
+// Every cell is a tinted quad from the same atlas texture, so raylib batches
+// consecutive cells into a single draw call
+static void drawPipeSegment(int x, int y, PipeType type, Color color, int offset) {
+    if (type == PIPE_NONE) return;
+    
+    DrawTextureRec(atlas,
+                   (Rectangle){ type * cellSize, 0, cellSize, cellSize },
+                   (Vector2){ x * cellSize, y * cellSize }, color);
+}
+
+static void updatePipe(Pipe *pipe) {
+    TRACE_SCOPE("update_pipe");
+    if (pipeParked(pipe)) {
+        initPipe(pipe);
+    } else if (pipe->steps >= PIPE_SEGMENTS) {
+        Direction newDir = chooseNewDirection(pipe->x, pipe->y, pipe->dir);
+        Direction from = (Direction)((pipe->dir + 2) % 4);
+        
+        Cell *cell = &grid[pipe->y * gridWidth + pipe->x];
+        cell->type = getPipeType(from, newDir);
+        cell->color = pipe->color;
+        if (recordEvents) draw_events_pipe(&events, DRAW_EVENT_SEGMENT, newDir, (int)(pipe - pipes));
+        
+        // Cells never change once placed, so they go straight to the canvas
+        drawPipeSegment(pipe->x, pipe->y, cell->type, pipeColors[pipe->color], 0);
+        
+        switch (pipe->dir) {
+            case DIR_UP:    pipe->y--; break;
+            case DIR_RIGHT: pipe->x++; break;
+            case DIR_DOWN:  pipe->y++; break;
+            case DIR_LEFT:  pipe->x--; break;
+        }
+        
+        if (pipe->x < 0 || pipe->x >= gridWidth || 
+            pipe->y < 0 || pipe->y >= gridHeight || 
+            grid[pipe->y * gridWidth + pipe->x].type != PIPE_NONE) {
+            initPipe(pipe);
+        } else {
+            free_cells_claim(&freeCells, pipe->y * gridWidth + pipe->x);
+            pipe->dir = newDir;
+            pipe->steps = 0;
+        }
+    } else {
+        pipe->steps++;
+    }
+}
+
+static void redrawCanvas() {
+    TRACE_SCOPE("redraw canvas");
+    buildAtlas();
+    
+    BeginTextureMode(canvas);
+    ClearBackground(BLACK);
+    for (int y = 0; y < gridHeight; y++) {
+        for (int x = 0; x < gridWidth; x++) {
+            Cell cell = grid[y * gridWidth + x];
+            drawPipeSegment(x, y, cell.type, pipeColors[cell.color], 0);
+        }
+    }
+    EndTextureMode();
+    canvasDirty = 0;
+}
+
 static void drawPartialPipe(Pipe *pipe) {
     int progress = (pipe->steps * cellSize) / PIPE_SEGMENTS;
     int x = pipe->x;
@@ -217,11 +359,59 @@ static void drawPartialPipe(Pipe *pipe) {
     }
 }
 
+// Size the grid to fill the canvas with cells close to targetCellSize. The
+// overlapping part of the previous grid is kept so resizes do not wipe it.
+static void setupGrid(int width, int height) {
+    int newWidth = width / targetCellSize;
+    int newHeight = height / targetCellSize;
+    if (newWidth < 1) newWidth = 1;
+    if (newHeight < 1) newHeight = 1;
+    
+    Cell *newGrid = (Cell*)calloc(newWidth * newHeight, sizeof(Cell));
+    if (grid) {
+        int copyWidth = newWidth < gridWidth ? newWidth : gridWidth;
+        int copyHeight = newHeight < gridHeight ? newHeight : gridHeight;
+        for (int y = 0; y < copyHeight; y++) {
+            memcpy(&newGrid[y * newWidth], &grid[y * gridWidth], copyWidth * sizeof(Cell));
+        }
+        free(grid);
+    }
+    
+    grid = newGrid;
+    gridWidth = newWidth;
+    gridHeight = newHeight;
+    cellSize = fmin(width / gridWidth, height / gridHeight);
+    
+    free_cells_destroy(&freeCells);
+    free_cells_init(&freeCells, gridWidth * gridHeight);
+    free_cells_reset(&freeCells);
+    for (int i = 0; i < gridWidth * gridHeight; i++) {
+        if (grid[i].type != PIPE_NONE) {
+            free_cells_claim(&freeCells, i);
+        }
+    }
+    
+    for (int i = 0; i < numPipes; i++) {
+        if (pipeParked(&pipes[i]) || pipes[i].x >= gridWidth || pipes[i].y >= gridHeight) {
+            initPipe(&pipes[i]);
+        } else {
+            free_cells_claim(&freeCells, pipes[i].y * gridWidth + pipes[i].x);
+        }
+    }
+    
+    canvasDirty = 1;
+    recordScene();
+}
+
 EMSCRIPTEN_KEEPALIVE
 void pipes2d_init(int canvasWidth, int canvasHeight) {
     SetConfigFlags(FLAG_WINDOW_RESIZABLE);
     InitWindow(canvasWidth, canvasHeight, "Pipes 2D");
+#ifndef __EMSCRIPTEN__
+    // In the browser requestAnimationFrame paces frames; raylib's limiter
+    // would sleep inside EndDrawing, which only works with ASYNCIFY
     SetTargetFPS(60);
+#endif
     
     // Initialize colors
     pipeColors[0] = (Color){255, 0, 0, 255};      // Red
@@ -232,55 +422,261 @@ void pipes2d_init(int canvasWidth, int canvasHeight) {
     pipeColors[5] = (Color){0, 255, 255, 255};    // Cyan
     pipeColors[6] = (Color){255, 165, 0, 255};    // Orange
     
-    // Clear grid
-    memset(grid, 0, sizeof(grid));
+    // Clear grid, and the pipes of an earlier run with it
+    free(grid);
+    grid = NULL;
+    numPipes = 0;
+    setupGrid(canvasWidth, canvasHeight);
+    
+    if (canvas.id != 0) {
+        UnloadRenderTexture(canvas);
+    }
+    canvas = LoadRenderTexture(canvasWidth, canvasHeight);
+    canvasDirty = 1;
     
-    // Initialize pipes
+    // Initialize pipes. setupGrid() recorded the empty scene and each spawn
+    // records itself.
     numPipes = 3;
     for (int i = 0; i < numPipes; i++) {
         initPipe(&pipes[i]);
     }
 }
 
+// Composite the canvas and the pipes growing toward their next cell
+static void presentFrame() {
+    TRACE_SCOPE("draw");
+    BeginDrawing();
+    ClearBackground(BLACK);
+    
+    // Composite placed cells (negative height flips the render texture)
+    DrawTextureRec(canvas.texture,
+                   (Rectangle){ 0, 0, canvas.texture.width, -canvas.texture.height },
+                   (Vector2){ 0, 0 }, WHITE);
+    
+    // Draw active pipe segments
+    for (int i = 0; i < numPipes; i++) {
+        if (!pipeParked(&pipes[i])) drawPartialPipe(&pipes[i]);
+    }
+    
+    TRACE_SCOPE("present");
+    EndDrawing();
+}
+
 EMSCRIPTEN_KEEPALIVE
 void pipes2d_frame() {
+    TRACE_SCOPE("frame");
     frameCounter++;
     
-    // Update pipes based on speed
-    if (frameCounter % (60 / speed) == 0) {
-        for (int i = 0; i < numPipes; i++) {
-            updatePipe(&pipes[i]);
-        }
+    if (canvasDirty) {
+        redrawCanvas();
     }
     
-    BeginDrawing();
-    ClearBackground(BLACK);
+    // speed is in steps per second at 60 FPS. Every step of a turbo frame
+    // draws its newly placed cells inside the same texture pass.
+    stepAccumulator += speed * stepsPerFrame;
+    int steps = stepAccumulator / 60;
+    stepAccumulator %= 60;
+    if (steps > MAX_STEPS_PER_FRAME) steps = MAX_STEPS_PER_FRAME;
     
-    // Draw existing pipes
-    for (int y = 0; y < GRID_HEIGHT; y++) {
-        for (int x = 0; x < GRID_WIDTH; x++) {
-            if (grid[y][x].type != PIPE_NONE) {
-                drawPipeSegment(x, y, grid[y][x].type, pipeColors[grid[y][x].color], 0);
+    if (steps > 0) {
+        TRACE_SCOPE("update");
+        BeginTextureMode(canvas);
+        for (int step = 0; step < steps; step++) {
+            for (int i = 0; i < numPipes; i++) {
+                updatePipe(&pipes[i]);
             }
+            if (recordEvents) draw_events_put(&events, DRAW_EVENT_STEP, 0, 0, NULL);
         }
+        EndTextureMode();
     }
     
-    // Draw active pipe segments
-    for (int i = 0; i < numPipes; i++) {
-        drawPartialPipe(&pipes[i]);
+    if (recordEvents) {
+        unsigned int fade = 0;
+        draw_events_put(&events, DRAW_EVENT_FRAME, 0, 1, &fade);
     }
+    presentFrame();
+}
+
+static void replayEvent(const DrawEvent *event) {
+    const unsigned int *v = event->values;
+    if (event->type == DRAW_EVENT_RESET) {
+        if (event->arg != DRAW_EVENTS_FLAT || event->count < 4 || v[0] < 1 || v[1] < 1 ||
+            v[0] > 0xFFFF || v[1] > 0xFFFF || v[2] < 1 || v[2] > 0xFFFF || v[3] > v[2]) {
+            return;
+        }
+        Cell *newGrid = (Cell*)calloc((size_t)v[0] * v[1], sizeof(Cell));
+        if (!newGrid) return;
+        free(grid);
+        grid = newGrid;
+        gridWidth = v[0];
+        gridHeight = v[1];
+        cellSize = v[2];
+        thickness = v[3];
+        numPipes = 0;
+        canvasDirty = 1;
+        return;
+    }
+    if (!grid) return;
     
-    EndDrawing();
+    switch (event->type) {
+        case DRAW_EVENT_CLEAR:
+            memset(grid, 0, gridWidth * gridHeight * sizeof(Cell));
+            canvasDirty = 1;
+            break;
+            
+        case DRAW_EVENT_CELL:
+            // Only follows a RESET, so the canvas redraw picks it up
+            if (v[0] < (unsigned int)gridWidth && v[1] < (unsigned int)gridHeight &&
+                event->arg < PIPE_TYPE_COUNT && v[3] < MAX_COLORS) {
+                Cell *cell = &grid[v[1] * gridWidth + v[0]];
+                cell->type = event->arg;
+                cell->color = v[3];
+            }
+            break;
+            
+        case DRAW_EVENT_STEP:
+            for (int i = 0; i < numPipes; i++) {
+                if (!stepped[i]) pipes[i].steps++;
+            }
+            memset(stepped, 0, sizeof(stepped));
+            break;
+            
+        case DRAW_EVENT_SPAWN:
+            if (v[0] < 10 && event->arg < 4 && v[1] < (unsigned int)gridWidth &&
+                v[2] < (unsigned int)gridHeight && v[3] <= PIPE_SEGMENTS && v[4] < MAX_COLORS) {
+                pipes[v[0]] = (Pipe){ v[1], v[2], (Direction)event->arg, v[4], v[3] };
+                if ((int)v[0] >= numPipes) numPipes = v[0] + 1;
+            }
+            break;
+            
+        case DRAW_EVENT_SEGMENT:
+            if (v[0] < 10 && event->arg < 4) {
+                // Same cell and move as updatePipe()
+                Pipe *pipe = &pipes[v[0]];
+                if (pipe->x >= 0 && pipe->x < gridWidth && pipe->y >= 0 && pipe->y < gridHeight) {
+                    Cell *cell = &grid[pipe->y * gridWidth + pipe->x];
+                    cell->type = getPipeType((Direction)((pipe->dir + 2) % 4), (Direction)event->arg);
+                    cell->color = pipe->color;
+                    drawPipeSegment(pipe->x, pipe->y, cell->type, pipeColors[pipe->color], 0);
+                }
+                switch (pipe->dir) {
+                    case DIR_UP:    pipe->y--; break;
+                    case DIR_RIGHT: pipe->x++; break;
+                    case DIR_DOWN:  pipe->y++; break;
+                    case DIR_LEFT:  pipe->x--; break;
+                }
+                pipe->dir = (Direction)event->arg;
+                pipe->steps = 0;
+                stepped[v[0]] = 1;
+            }
+            break;
+            
+        case DRAW_EVENT_DIE:
+            if ((int)v[0] < numPipes) numPipes = v[0];
+            break;
+    }
+}
+
+// Draw the next frame of a stream recorded with pipes2d_setEventRecording()
+// instead of simulating. Returns the bytes used, 0 while the next frame is
+// incomplete, in which case the last one is shown again; the caller keeps
+// the rest. The stream's RESET sets the grid and cell size, so displays
+// show the recorder's layout whatever their window size.
+EMSCRIPTEN_KEEPALIVE
+int pipes2d_replayFrame(const unsigned char *data, int size) {
+    TRACE_SCOPE("frame");
+    replaying = 1;
+    
+    DrawEvent event;
+    size_t end = draw_events_frame_size(data, size > 0 ? size : 0, &event);
+    if (end) {
+        frameCounter++;
+        
+        // Events before the first step were logged between frames, so the
+        // canvas is redrawn after them, as pipes2d_frame() would
+        int started = 0;
+        for (size_t pos = 0; pos < end;) {
+            size_t start = pos;
+            if (draw_events_next(data, end, &pos, &event) < 0) {
+                pos = start + 1;
+                continue;
+            }
+            if (!started && (event.type == DRAW_EVENT_STEP || event.type == DRAW_EVENT_SEGMENT ||
+                             event.type == DRAW_EVENT_FRAME)) {
+                if (canvasDirty) {
+                    redrawCanvas();
+                }
+                BeginTextureMode(canvas);
+                started = 1;
+            }
+            replayEvent(&event);
+        }
+        EndTextureMode();
+    }
+    
+    presentFrame();
+    return (int)end;
+}
+
+// Log what every step draws for pipes2d_replayFrame() elsewhere. Starting
+// records the current scene first; stopping drops the log.
+EMSCRIPTEN_KEEPALIVE
+void pipes2d_setEventRecording(int enabled) {
+    int wasRecording = recordEvents;
+    recordEvents = enabled != 0;
+    if (!enabled) {
+        draw_events_free(&events);
+    } else if (!wasRecording) {
+        recordScene();
+    }
+}
+
+EMSCRIPTEN_KEEPALIVE
+unsigned char *pipes2d_getEvents() {
+    return events.data;
+}
+
+EMSCRIPTEN_KEEPALIVE
+int pipes2d_getEventSize() {
+    return (int)events.size;
+}
+
+// Once the caller has sent the events on
+EMSCRIPTEN_KEEPALIVE
+void pipes2d_clearEvents() {
+    draw_events_clear(&events);
 }
 
 EMSCRIPTEN_KEEPALIVE
 void pipes2d_setSpeed(int newSpeed) {
-    speed = newSpeed;
+    if (newSpeed > 0) {
+        speed = newSpeed;
+    }
+}
+
+EMSCRIPTEN_KEEPALIVE
+void pipes2d_setStepsPerFrame(int steps) {
+    if (steps < 1) steps = 1;
+    if (steps > MAX_STEPS_PER_FRAME) steps = MAX_STEPS_PER_FRAME;
+    stepsPerFrame = steps;
 }
 
 EMSCRIPTEN_KEEPALIVE
 void pipes2d_setThickness(int newThickness) {
     thickness = newThickness;
+    canvasDirty = 1;
+    recordScene();
+}
+
+EMSCRIPTEN_KEEPALIVE
+void pipes2d_setCellSize(int size) {
+    if (size < MIN_CELL_SIZE || !grid || replaying) return;
+    
+    // Cell coordinates mean something else at a new size, so start over
+    targetCellSize = size;
+    free(grid);
+    grid = NULL;
+    setupGrid(GetScreenWidth(), GetScreenHeight());
 }
 
 EMSCRIPTEN_KEEPALIVE
@@ -290,6 +686,8 @@ void pipes2d_setPipeCount(int count) {
             for (int i = numPipes; i < count; i++) {
                 initPipe(&pipes[i]);
             }
+        } else if (count < numPipes && recordEvents) {
+            draw_events_pipe(&events, DRAW_EVENT_DIE, 0, count);
         }
         numPipes = count;
     }
@@ -298,10 +696,26 @@ void pipes2d_setPipeCount(int count) {
 EMSCRIPTEN_KEEPALIVE
 void pipes2d_resize(int width, int height) {
     SetWindowSize(width, height);
-    cellSize = fmin(width / GRID_WIDTH, height / GRID_HEIGHT);
+    if (!replaying) setupGrid(width, height);
+    
+    UnloadRenderTexture(canvas);
+    canvas = LoadRenderTexture(width, height);
+    canvasDirty = 1;
 }
 
 EMSCRIPTEN_KEEPALIVE
 void pipes2d_cleanup() {
+    if (canvas.id != 0) {
+        UnloadRenderTexture(canvas);
+        canvas = (RenderTexture2D){ 0 };
+    }
+    if (atlas.id != 0) {
+        UnloadTexture(atlas);
+        atlas = (Texture2D){ 0 };
+    }
+    free(grid);
+    grid = NULL;
+    free_cells_destroy(&freeCells);
+    draw_events_free(&events);
     CloseWindow();
 }
\ No newline at end of file
@@ -1,9 +1,21 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <time.h>
+#ifdef __EMSCRIPTEN__
 #include <emscripten/emscripten.h>
+#else
+#define EMSCRIPTEN_KEEPALIVE
+#endif
 #include <raylib.h>
 #include <raymath.h>
+#include <rlgl.h>
+#include "command_ring.h"
+#include "draw_events.h"
+#include "free_cells.h"
+#include "neighbor_grid.h"
+#include "snapshot.h"
+#include "trace.h"
 
 #define MAX_PIPES 10
 #define GRID_SIZE 4.0f
@@ -11,6 +23,28 @@
 #define SEGMENT_LENGTH 2.0f
 #define MAX_PIPE_LENGTH 30
 #define GRID_DIMENSION 20
+#define GRID_CELLS (GRID_DIMENSION * GRID_DIMENSION * GRID_DIMENSION)
+#define RECYCLE_OCCUPANCY 85 // Percent of cells claimed before the grid is cleared
+#define MAX_STEPS_PER_FRAME 10000
+#define MIN_RENDER_SCALE 0.25f
+#define RENDER_SCALE_STEP 0.05f
+#define RENDER_SCALE_COOLDOWN 30 // Frames between automatic scale changes
+#define EVENT_PARAM_GROWTH_SPEED 0 // PARAM carrying pipe_growth_speed's bits
+#define EVENT_PARAM_FADE_SPEED 1
+#define EVENT_DIE_STORED 1 // DIE's arg when the pipe stored its position as a segment first
+#define RETAINED_CHUNKS 8
+#define RETAINED_CHUNK_VERTICES 65535 // Mesh indices are 16-bit
+#define RETAINED_CHUNK_INDICES (RETAINED_CHUNK_VERTICES * 5)
+#define RETAINED_SIDES 16 // As the live pipes
+#define RETAINED_RINGS 6
+#define RETAINED_SLICES 12
+#define CYLINDER_VERTICES (2 * RETAINED_SIDES)
+#define CYLINDER_INDICES (6 * RETAINED_SIDES)
+#define SPHERE_VERTICES ((RETAINED_RINGS + 1) * (RETAINED_SLICES + 1))
+#define SPHERE_INDICES (6 * RETAINED_RINGS * RETAINED_SLICES)
+// pipes3d_getFrameState() flags, as PIPES_FRAME_* in src/pipes.h
+#define FRAME_UNCHANGED 1 // Nothing moved, the last render was shown again
+#define FRAME_EMPTY 2     // No live or retained pipes, only a spawn can change the scene
 
 // Tunable parameters
 static int fade_speed = 1;
@@ -20,6 +54,9 @@ static int max_active_pipes = 4;
 static float camera_rotation_speed = 0.002f;
 static float pipe_growth_speed = 0.05f;
 static int segment_update_delay = 10;
+static int steps_per_frame = 1;
+static float render_scale = 1.0f;
+static int auto_scale_target_fps = 0; // 0 = fixed render scale
 
 typedef struct {
     Vector3 pos;
@@ -33,18 +70,54 @@ typedef struct {
     float growth_progress;
 } Pipe3D;
 
+// Finished pipes stay on the GPU until they have faded. Every vertex carries
+// the fade clock at which its pipe finished, relative to its chunk's base,
+// and the aging shader subtracts the age from its color as the 2D engine
+// fades its pixels, so aging costs one uniform per chunk however many
+// segments are retained. Chunks fill in order and are released whole once
+// their newest pipe has faded.
+typedef struct {
+    Mesh mesh; // Dynamic buffers of RETAINED_CHUNK_VERTICES, loaded on first use
+    int vertex_count;
+    int index_count;
+    double base;   // Fade clock the births in this chunk count from
+    double newest; // Fade clock when its last pipe finished
+} RetainedChunk;
+
 typedef struct {
     Pipe3D pipes[MAX_PIPES];
     int active_pipes;
-    bool grid[GRID_DIMENSION][GRID_DIMENSION][GRID_DIMENSION];
+    unsigned char cells[GRID_CELLS];
+    NeighborGrid grid; // Occupancy and free neighbors of cells, indexed by cell_index()
+    FreeCells free_cells; // Unclaimed grid cells, indexed by cell_index()
     Camera3D camera;
     Vector2 lastMousePos;
     bool mouseDown;
     RenderTexture2D target;
+    int targetWidth;  // Allocated size of target, may exceed the window
+    int targetHeight;
+    int frameWidth;   // Part of target drawn by the last frame
+    int frameHeight;
+    float frameTimeAvg;
+    int scaleCooldown;
     float rotation;
+    RetainedChunk retained[RETAINED_CHUNKS]; // Ring, oldest at retainedFirst
+    int retainedFirst;
+    int retainedCount;
+    double fadeClock; // Full fades since init, advanced by fade_speed / 255 per step
+    Material aging;
+    int agingClockLoc;
+    int sceneChanged; // Pipes moved or aged since the last render
+    Vector3 renderedCamera; // Camera position of the last render
+    int frameState; // FRAME_* of the last frame
 } PipeSystem3D;
 
 static PipeSystem3D* system3d = NULL;
+static CommandRing command_ring;
+static unsigned int random_state = 1; // Own generator instead of rand() so snapshots can carry its state
+static DrawEventLog events; // Draw-event recording, see src/draw_events.h
+static int record_events = 0;
+static unsigned char stepped[MAX_PIPES]; // Replay: pipes that completed a segment this step
 
 // Available pipe colors
 static Color pipe_colors[] = {
@@ -58,7 +131,7 @@ static Color pipe_colors[] = {
     { 165, 67, 255, 255 }   // Purple
 };
 
-// Direction vectors
+// Direction vectors, opposite directions paired as neighbor_grid.h expects
 static Vector3 directions[] = {
     { 1, 0, 0 },   // Right
     { -1, 0, 0 },  // Left
@@ -68,19 +141,385 @@ static Vector3 directions[] = {
     { 0, 0, -1 }   // Back
 };
 
+static const signed char direction_steps[6][3] = {
+    { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 }
+};
+
+static int direction_index(Vector3 dir) {
+    for (int i = 0; i < 6; i++) {
+        if (dir.x == directions[i].x && dir.y == directions[i].y && dir.z == directions[i].z) return i;
+    }
+    return 0;
+}
+
+// xorshift32, in rand()'s 0..2^31-1 range
+static int next_random() {
+    unsigned int x = random_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    random_state = x;
+    return (int)(x >> 1);
+}
+
+// Grow the offscreen target to at least width x height. Shrinking windows and
+// render scale changes reuse the existing texture through a smaller viewport.
+static void ensure_render_target(int width, int height) {
+    if (system3d->target.id != 0 &&
+        width <= system3d->targetWidth && height <= system3d->targetHeight) {
+        return;
+    }
+    
+    if (system3d->target.id != 0) {
+        UnloadRenderTexture(system3d->target);
+    }
+    
+    system3d->targetWidth = width > system3d->targetWidth ? width : system3d->targetWidth;
+    system3d->targetHeight = height > system3d->targetHeight ? height : system3d->targetHeight;
+    system3d->target = LoadRenderTexture(system3d->targetWidth, system3d->targetHeight);
+    SetTextureFilter(system3d->target.texture, TEXTURE_FILTER_BILINEAR);
+    system3d->sceneChanged = 1;
+}
+
+static int cell_index(int gx, int gy, int gz) {
+    return (gx * GRID_DIMENSION + gy) * GRID_DIMENSION + gz;
+}
+
+static void claim_cell(int gx, int gy, int gz) {
+    neighbor_grid_claim(&system3d->grid, gx, gy, gz);
+    free_cells_claim(&system3d->free_cells, cell_index(gx, gy, gz));
+}
+
+// Grid cell containing a world position, or -1 outside the grid
+static int position_cell(Vector3 pos, int* gx, int* gy, int* gz) {
+    *gx = (int)((pos.x + GRID_DIMENSION * GRID_SIZE / 2) / GRID_SIZE);
+    *gy = (int)((pos.y + GRID_DIMENSION * GRID_SIZE / 2) / GRID_SIZE);
+    *gz = (int)((pos.z + GRID_DIMENSION * GRID_SIZE / 2) / GRID_SIZE);
+    
+    if (*gx >= 0 && *gx < GRID_DIMENSION &&
+        *gy >= 0 && *gy < GRID_DIMENSION &&
+        *gz >= 0 && *gz < GRID_DIMENSION) {
+        return cell_index(*gx, *gy, *gz);
+    }
+    return -1;
+}
+
+static void claim_position(Vector3 pos) {
+    int gx, gy, gz;
+    if (position_cell(pos, &gx, &gy, &gz) >= 0) {
+        claim_cell(gx, gy, gz);
+    }
+}
+
+static void clear_grid() {
+    memset(system3d->cells, 0, sizeof(system3d->cells));
+    neighbor_grid_rebuild(&system3d->grid);
+    free_cells_reset(&system3d->free_cells);
+}
+
+// Retained vertices carry their birth on the fade clock in texcoord.x. A
+// channel is gone once the age reaches its value, the whole vertex at 1.
+#ifdef __EMSCRIPTEN__
+static const char* aging_vertex_shader =
+    "#version 100\n"
+    "attribute vec3 vertexPosition;\n"
+    "attribute vec2 vertexTexCoord;\n"
+    "attribute vec4 vertexColor;\n"
+    "uniform mat4 mvp;\n"
+    "uniform float fadeClock;\n"
+    "varying vec3 fragColor;\n"
+    "void main() {\n"
+    "    fragColor = vertexColor.rgb - (fadeClock - vertexTexCoord.x);\n"
+    "    gl_Position = mvp * vec4(vertexPosition, 1.0);\n"
+    "}\n";
+static const char* aging_fragment_shader =
+    "#version 100\n"
+    "precision mediump float;\n"
+    "varying vec3 fragColor;\n"
+    "void main() {\n"
+    "    if (max(fragColor.r, max(fragColor.g, fragColor.b)) <= 0.0) discard;\n"
+    "    gl_FragColor = vec4(max(fragColor, 0.0), 1.0);\n"
+    "}\n";
+#else
+static const char* aging_vertex_shader =
+    "#version 330\n"
+    "in vec3 vertexPosition;\n"
+    "in vec2 vertexTexCoord;\n"
+    "in vec4 vertexColor;\n"
+    "uniform mat4 mvp;\n"
+    "uniform float fadeClock;\n"
+    "out vec3 fragColor;\n"
+    "void main() {\n"
+    "    fragColor = vertexColor.rgb - (fadeClock - vertexTexCoord.x);\n"
+    "    gl_Position = mvp * vec4(vertexPosition, 1.0);\n"
+    "}\n";
+static const char* aging_fragment_shader =
+    "#version 330\n"
+    "in vec3 fragColor;\n"
+    "out vec4 finalColor;\n"
+    "void main() {\n"
+    "    if (max(fragColor.r, max(fragColor.g, fragColor.b)) <= 0.0) discard;\n"
+    "    finalColor = vec4(max(fragColor, 0.0), 1.0);\n"
+    "}\n";
+#endif
+
+static void load_aging_material() {
+    system3d->aging = LoadMaterialDefault();
+    system3d->aging.shader = LoadShaderFromMemory(aging_vertex_shader, aging_fragment_shader);
+    system3d->agingClockLoc = GetShaderLocation(system3d->aging.shader, "fadeClock");
+}
+
+static int load_retained_chunk(RetainedChunk* chunk) {
+    Mesh mesh = { 0 };
+    mesh.vertexCount = RETAINED_CHUNK_VERTICES;
+    mesh.triangleCount = RETAINED_CHUNK_INDICES / 3;
+    mesh.vertices = (float*)RL_CALLOC(RETAINED_CHUNK_VERTICES * 3, sizeof(float));
+    mesh.texcoords = (float*)RL_CALLOC(RETAINED_CHUNK_VERTICES * 2, sizeof(float));
+    mesh.colors = (unsigned char*)RL_CALLOC(RETAINED_CHUNK_VERTICES * 4, sizeof(unsigned char));
+    mesh.indices = (unsigned short*)RL_CALLOC(RETAINED_CHUNK_INDICES, sizeof(unsigned short));
+    if (!mesh.vertices || !mesh.texcoords || !mesh.colors || !mesh.indices) {
+        RL_FREE(mesh.vertices);
+        RL_FREE(mesh.texcoords);
+        RL_FREE(mesh.colors);
+        RL_FREE(mesh.indices);
+        return 0;
+    }
+    UploadMesh(&mesh, true);
+    chunk->mesh = mesh;
+    return 1;
+}
+
+// Drop all retained pipes, keeping the chunks' buffers
+static void clear_retained() {
+    for (int i = 0; i < RETAINED_CHUNKS; i++) {
+        system3d->retained[i].vertex_count = 0;
+        system3d->retained[i].index_count = 0;
+    }
+    system3d->retainedFirst = 0;
+    system3d->retainedCount = 0;
+    system3d->fadeClock = 0;
+    system3d->sceneChanged = 1;
+}
+
+// Chunk with room for a pipe of this size. A new chunk starts when the
+// newest is full; with all of them in use the oldest goes early.
+static RetainedChunk* retained_space(int vertices, int indices) {
+    if (system3d->retainedCount > 0) {
+        RetainedChunk* last = &system3d->retained[(system3d->retainedFirst + system3d->retainedCount - 1) % RETAINED_CHUNKS];
+        if (last->vertex_count + vertices <= RETAINED_CHUNK_VERTICES &&
+            last->index_count + indices <= RETAINED_CHUNK_INDICES) {
+            return last;
+        }
+    }
+    
+    if (system3d->retainedCount == RETAINED_CHUNKS) {
+        system3d->retainedFirst = (system3d->retainedFirst + 1) % RETAINED_CHUNKS;
+        system3d->retainedCount--;
+    }
+    RetainedChunk* chunk = &system3d->retained[(system3d->retainedFirst + system3d->retainedCount) % RETAINED_CHUNKS];
+    if (!chunk->mesh.vboId && !load_retained_chunk(chunk)) return NULL;
+    chunk->vertex_count = 0;
+    chunk->index_count = 0;
+    chunk->base = system3d->fadeClock;
+    system3d->retainedCount++;
+    return chunk;
+}
+
+static void retained_vertex(RetainedChunk* chunk, Vector3 pos, Color color, float birth) {
+    int v = chunk->vertex_count++;
+    chunk->mesh.vertices[v * 3] = pos.x;
+    chunk->mesh.vertices[v * 3 + 1] = pos.y;
+    chunk->mesh.vertices[v * 3 + 2] = pos.z;
+    chunk->mesh.texcoords[v * 2] = birth;
+    chunk->mesh.texcoords[v * 2 + 1] = 0.0f;
+    memcpy(&chunk->mesh.colors[v * 4], &color, 4);
+}
+
+static void retained_quad(RetainedChunk* chunk, int a, int b, int c, int d) {
+    unsigned short* index = &chunk->mesh.indices[chunk->index_count];
+    index[0] = a; index[1] = b; index[2] = c;
+    index[3] = a; index[4] = c; index[5] = d;
+    chunk->index_count += 6;
+}
+
+// Open tube like DrawCylinderEx(); joints and ends are covered by spheres
+static void retain_cylinder(RetainedChunk* chunk, Vector3 start, Vector3 end, Color color, float birth) {
+    Vector3 axis = Vector3Normalize(Vector3Subtract(end, start));
+    Vector3 up = fabsf(axis.y) > 0.99f ? (Vector3){ 1, 0, 0 } : (Vector3){ 0, 1, 0 };
+    Vector3 u = Vector3Normalize(Vector3CrossProduct(axis, up));
+    Vector3 w = Vector3CrossProduct(axis, u);
+    
+    int first = chunk->vertex_count;
+    for (int i = 0; i < RETAINED_SIDES; i++) {
+        float angle = 2.0f * PI * i / RETAINED_SIDES;
+        Vector3 offset = Vector3Add(Vector3Scale(u, cosf(angle) * PIPE_RADIUS),
+                                    Vector3Scale(w, sinf(angle) * PIPE_RADIUS));
+        retained_vertex(chunk, Vector3Add(start, offset), color, birth);
+        retained_vertex(chunk, Vector3Add(end, offset), color, birth);
+    }
+    for (int i = 0; i < RETAINED_SIDES; i++) {
+        int j = (i + 1) % RETAINED_SIDES;
+        retained_quad(chunk, first + 2 * i, first + 2 * i + 1, first + 2 * j + 1, first + 2 * j);
+    }
+}
+
+static void retain_sphere(RetainedChunk* chunk, Vector3 center, float radius, Color color, float birth) {
+    int first = chunk->vertex_count;
+    for (int ring = 0; ring <= RETAINED_RINGS; ring++) {
+        float lat = PI * ring / RETAINED_RINGS;
+        for (int slice = 0; slice <= RETAINED_SLICES; slice++) {
+            float lon = 2.0f * PI * slice / RETAINED_SLICES;
+            Vector3 offset = { sinf(lat) * cosf(lon), cosf(lat), sinf(lat) * sinf(lon) };
+            retained_vertex(chunk, Vector3Add(center, Vector3Scale(offset, radius)), color, birth);
+        }
+    }
+    for (int ring = 0; ring < RETAINED_RINGS; ring++) {
+        for (int slice = 0; slice < RETAINED_SLICES; slice++) {
+            int a = first + ring * (RETAINED_SLICES + 1) + slice;
+            retained_quad(chunk, a, a + RETAINED_SLICES + 1, a + RETAINED_SLICES + 2, a + 1);
+        }
+    }
+}
+
+// Keep what draw_pipe() showed of a pipe that just finished, aging from now
+static void retain_pipe(const Pipe3D* pipe) {
+    if (pipe->segment_count < 2 || !system3d->aging.maps) return;
+    TRACE_SCOPE("retain_pipe");
+    
+    int cylinders = pipe->segment_count - 1;
+    int spheres = pipe->segment_count - 2;
+    RetainedChunk* chunk = retained_space(cylinders * CYLINDER_VERTICES + spheres * SPHERE_VERTICES,
+                                          cylinders * CYLINDER_INDICES + spheres * SPHERE_INDICES);
+    if (!chunk) return;
+    
+    int first_vertex = chunk->vertex_count;
+    int first_index = chunk->index_count;
+    float birth = (float)(system3d->fadeClock - chunk->base);
+    for (int i = 0; i < cylinders; i++) {
+        retain_cylinder(chunk, pipe->segments[i], pipe->segments[i + 1], pipe->color, birth);
+        if (i < spheres) {
+            retain_sphere(chunk, pipe->segments[i + 1], PIPE_RADIUS * 1.1f, pipe->color, birth);
+        }
+    }
+    chunk->newest = system3d->fadeClock;
+    
+    // Only the new part goes to the GPU
+    int vertices = chunk->vertex_count - first_vertex;
+    int indices = chunk->index_count - first_index;
+    // Buffer slots as raylib 5.0's UploadMesh() fills them: 0 positions,
+    // 1 texcoords, 3 colors, 6 indices. rlgl.h only names the index slot
+    // from 5.5 on.
+    UpdateMeshBuffer(chunk->mesh, 0, chunk->mesh.vertices + first_vertex * 3,
+                     vertices * 3 * sizeof(float), first_vertex * 3 * sizeof(float));
+    UpdateMeshBuffer(chunk->mesh, 1, chunk->mesh.texcoords + first_vertex * 2,
+                     vertices * 2 * sizeof(float), first_vertex * 2 * sizeof(float));
+    UpdateMeshBuffer(chunk->mesh, 3, chunk->mesh.colors + first_vertex * 4,
+                     vertices * 4, first_vertex * 4);
+    // WebGL keeps index buffers off the vertex buffer binding
+    rlUpdateVertexBufferElements(chunk->mesh.vboId[6], chunk->mesh.indices + first_index,
+                                 indices * sizeof(unsigned short), first_index * sizeof(unsigned short));
+}
+
+// Whether a step changes what is drawn: live pipes grow, retained ones age
+static int step_changes_scene() {
+    return system3d->active_pipes > 0 || (system3d->retainedCount > 0 && fade_speed > 0);
+}
+
+// Release the oldest chunks once everything in them has faded
+static void release_faded() {
+    while (system3d->retainedCount > 0) {
+        RetainedChunk* chunk = &system3d->retained[system3d->retainedFirst];
+        if (system3d->fadeClock - chunk->newest < 1.0) break;
+        chunk->vertex_count = 0;
+        chunk->index_count = 0;
+        system3d->retainedFirst = (system3d->retainedFirst + 1) % RETAINED_CHUNKS;
+        system3d->retainedCount--;
+    }
+}
+
+static void draw_retained() {
+    // Retained triangles are wound either way
+    rlDisableBackfaceCulling();
+    for (int i = 0; i < system3d->retainedCount; i++) {
+        RetainedChunk* chunk = &system3d->retained[(system3d->retainedFirst + i) % RETAINED_CHUNKS];
+        float clock = (float)(system3d->fadeClock - chunk->base);
+        SetShaderValue(system3d->aging.shader, system3d->agingClockLoc, &clock, SHADER_UNIFORM_FLOAT);
+        chunk->mesh.triangleCount = chunk->index_count / 3;
+        DrawMesh(chunk->mesh, system3d->aging, MatrixIdentity());
+    }
+    rlEnableBackfaceCulling();
+}
+
+static int color_index(Color color);
+
+static void record_pipe(int type, int arg, const Pipe3D* pipe) {
+    if (record_events) draw_events_pipe(&events, type, arg, (int)(pipe - system3d->pipes));
+}
+
+// Growth is animated by replay from this, so it goes out as exact bits
+static unsigned int growth_speed_bits() {
+    unsigned int bits;
+    memcpy(&bits, &pipe_growth_speed, sizeof(bits));
+    return bits;
+}
+
+// A RESET and the live pipes, where a display can join the stream. Pipes
+// start on grid points and move in whole steps, so each one is its spawn
+// point and the moves since; only the growth of the current segment is not
+// carried and catches up at its next segment. Retained pipes are not sent,
+// so a display that joins late only sees pipes finish from then on.
+static void record_scene() {
+    if (!record_events || !system3d) return;
+    unsigned int values[2] = { growth_speed_bits(), (unsigned int)fade_speed };
+    draw_events_put(&events, DRAW_EVENT_RESET, DRAW_EVENTS_3D, 2, values);
+    for (int i = 0; i < MAX_PIPES; i++) {
+        const Pipe3D* pipe = &system3d->pipes[i];
+        if (!pipe->active) continue;
+        
+        Vector3 start = pipe->segment_count > 0 ? pipe->segments[0] : pipe->pos;
+        Vector3 next = pipe->segment_count > 1 ? pipe->segments[1] : pipe->pos;
+        int first_dir = pipe->segment_count > 0 ?
+            direction_index(Vector3Scale(Vector3Subtract(next, start), 1.0f / SEGMENT_LENGTH)) :
+            direction_index(pipe->direction);
+        int gx, gy, gz;
+        position_cell(start, &gx, &gy, &gz);
+        draw_events_spawn(&events, i, first_dir, gx, gy, gz, color_index(pipe->color));
+        
+        int dir = first_dir;
+        for (int s = 0; s < pipe->segment_count; s++) {
+            next = s + 1 < pipe->segment_count ? pipe->segments[s + 1] : pipe->pos;
+            dir = direction_index(Vector3Scale(Vector3Subtract(next, pipe->segments[s]), 1.0f / SEGMENT_LENGTH));
+            record_pipe(DRAW_EVENT_SEGMENT, dir, pipe);
+        }
+        if (dir != direction_index(pipe->direction)) {
+            record_pipe(DRAW_EVENT_ELBOW, direction_index(pipe->direction), pipe);
+        }
+    }
+}
+
 EMSCRIPTEN_KEEPALIVE
 void pipes3d_init(int canvasWidth, int canvasHeight) {
     if (!system3d) {
         system3d = (PipeSystem3D*)calloc(1, sizeof(PipeSystem3D));
+        free_cells_init(&system3d->free_cells, GRID_CELLS);
+        neighbor_grid_attach(&system3d->grid, system3d->cells,
+                             GRID_DIMENSION, GRID_DIMENSION, GRID_DIMENSION, direction_steps);
     }
     
     // Initialize Raylib with proper flags
     SetConfigFlags(FLAG_WINDOW_RESIZABLE);
     InitWindow(canvasWidth, canvasHeight, "Pipes 3D");
+#ifndef __EMSCRIPTEN__
+    // In the browser requestAnimationFrame paces frames; raylib's limiter
+    // would sleep inside EndDrawing, which only works with ASYNCIFY
     SetTargetFPS(60);
+#endif
     
     // Create render texture for offscreen rendering
-    system3d->target = LoadRenderTexture(canvasWidth, canvasHeight);
+    ensure_render_target(canvasWidth, canvasHeight);
+    if (!system3d->aging.maps) {
+        load_aging_material();
+    }
     
     // Setup camera
     system3d->camera.position = (Vector3){ 30.0f, 30.0f, 30.0f };
@@ -89,14 +528,8 @@ void pipes3d_init(int canvasWidth, int canvasHeight) {
     system3d->camera.fovy = 45.0f;
     system3d->camera.projection = CAMERA_PERSPECTIVE;
     
-    // Clear grid
-    for (int x = 0; x < GRID_DIMENSION; x++) {
-        for (int y = 0; y < GRID_DIMENSION; y++) {
-            for (int z = 0; z < GRID_DIMENSION; z++) {
-                system3d->grid[x][y][z] = false;
-            }
-        }
-    }
+    clear_grid();
+    clear_retained();
     
     // Initialize pipes
     for (int i = 0; i < MAX_PIPES; i++) {
@@ -106,10 +539,17 @@ void pipes3d_init(int canvasWidth, int canvasHeight) {
     
     system3d->active_pipes = 0;
     system3d->rotation = 0;
+    system3d->frameTimeAvg = 0;
+    system3d->scaleCooldown = 0;
+    
+    random_state = (unsigned int)time(NULL) | 1;
+    record_scene();
 }
 
+void pipes3d_setFadeSpeed(int speed);
+
 EMSCRIPTEN_KEEPALIVE
-void set_3d_fade_speed(int speed) { fade_speed = speed; }
+void set_3d_fade_speed(int speed) { pipes3d_setFadeSpeed(speed); }
 
 EMSCRIPTEN_KEEPALIVE
 void set_3d_spawn_rate(int rate) { spawn_rate = rate; }
@@ -162,72 +602,81 @@ void handle_mouse_move(int x, int y) {
     }
 }
 
-static bool is_grid_free(int x, int y, int z) {
-    if (x < 0 || x >= GRID_DIMENSION || 
-        y < 0 || y >= GRID_DIMENSION || 
-        z < 0 || z >= GRID_DIMENSION) {
-        return false;
-    }
-    return !system3d->grid[x][y][z];
-}
-
+// Random free direction out of the cell at pos, never straight back.
+// Directions into cells with no way onward are only taken as a last resort.
 static Vector3 get_random_direction(Vector3 current_dir, Vector3 pos) {
-    Vector3 possible_dirs[6];
-    int count = 0;
-    
-    for (int i = 0; i < 6; i++) {
-        // Don't go backwards
-        if (Vector3DotProduct(directions[i], Vector3Scale(current_dir, -1)) > 0.9f) {
-            continue;
-        }
-        
-        // Check if position is free
-        Vector3 newPos = Vector3Add(pos, Vector3Scale(directions[i], SEGMENT_LENGTH));
-        int gx = (int)((newPos.x + GRID_DIMENSION * GRID_SIZE / 2) / GRID_SIZE);
-        int gy = (int)((newPos.y + GRID_DIMENSION * GRID_SIZE / 2) / GRID_SIZE);
-        int gz = (int)((newPos.z + GRID_DIMENSION * GRID_SIZE / 2) / GRID_SIZE);
-        
-        if (is_grid_free(gx, gy, gz)) {
-            possible_dirs[count++] = directions[i];
-        }
-    }
+    TRACE_SCOPE("get_random_direction");
+    int gx, gy, gz;
+    int cell = position_cell(pos, &gx, &gy, &gz);
+    if (cell < 0) return current_dir;
     
-    if (count == 0) return current_dir;
-    return possible_dirs[rand() % count];
+    unsigned int mask = neighbor_grid_free(&system3d->grid, cell) & ~(1u << (direction_index(current_dir) ^ 1));
+    mask = neighbor_grid_avoid_dead_ends(&system3d->grid, cell, mask);
+    int dir = neighbor_pick(mask, next_random());
+    return dir >= 0 ? directions[dir] : current_dir;
 }
 
 static void spawn_pipe() {
     if (system3d->active_pipes >= max_active_pipes) return;
     
+    // Finished pipes fade out on their own, so a full grid can simply start
+    // over. Without fading they would stay forever and go with the grid.
+    if (free_cells_occupancy_percent(&system3d->free_cells) >= RECYCLE_OCCUPANCY) {
+        clear_grid();
+        if (fade_speed <= 0) {
+            clear_retained();
+            if (record_events) draw_events_put(&events, DRAW_EVENT_CLEAR, 0, 0, NULL);
+        }
+        for (int i = 0; i < MAX_PIPES; i++) {
+            Pipe3D* pipe = &system3d->pipes[i];
+            if (pipe->active) {
+                claim_position(pipe->pos);
+            }
+        }
+    }
+    
     for (int i = 0; i < MAX_PIPES; i++) {
         if (!system3d->pipes[i].active) {
-            // Random starting position
-            int gx = GRID_DIMENSION/4 + rand() % (GRID_DIMENSION/2);
-            int gy = GRID_DIMENSION/4 + rand() % (GRID_DIMENSION/2);
-            int gz = GRID_DIMENSION/4 + rand() % (GRID_DIMENSION/2);
+            // Random free starting position
+            int cell = free_cells_pick(&system3d->free_cells, next_random());
+            if (cell < 0) return;
             
-            if (!is_grid_free(gx, gy, gz)) continue;
+            int gz = cell % GRID_DIMENSION;
+            int gy = (cell / GRID_DIMENSION) % GRID_DIMENSION;
+            int gx = cell / (GRID_DIMENSION * GRID_DIMENSION);
             
             system3d->pipes[i].pos.x = (gx - GRID_DIMENSION/2) * GRID_SIZE;
             system3d->pipes[i].pos.y = (gy - GRID_DIMENSION/2) * GRID_SIZE;
             system3d->pipes[i].pos.z = (gz - GRID_DIMENSION/2) * GRID_SIZE;
-            system3d->pipes[i].direction = directions[rand() % 6];
-            system3d->pipes[i].color = pipe_colors[rand() % 8];
+            system3d->pipes[i].direction = directions[next_random() % 6];
+            system3d->pipes[i].color = pipe_colors[next_random() % 8];
             system3d->pipes[i].active = 1;
             system3d->pipes[i].length = 0;
             system3d->pipes[i].segment_count = 0;
             system3d->pipes[i].update_counter = 0;
             system3d->pipes[i].growth_progress = 0.0f;
+            if (record_events) {
+                draw_events_spawn(&events, i, direction_index(system3d->pipes[i].direction), gx, gy, gz,
+                                  color_index(system3d->pipes[i].color));
+            }
             
-            system3d->grid[gx][gy][gz] = true;
+            claim_cell(gx, gy, gz);
             system3d->active_pipes++;
             break;
         }
     }
 }
 
+static void finish_pipe(Pipe3D* pipe, int arg) {
+    record_pipe(DRAW_EVENT_DIE, arg, pipe);
+    retain_pipe(pipe);
+    pipe->active = 0;
+    system3d->active_pipes--;
+}
+
 static void update_pipe(Pipe3D* pipe) {
     if (!pipe->active) return;
+    TRACE_SCOPE("update_pipe");
     
     // Only update at specified intervals
     pipe->update_counter++;
@@ -254,35 +703,33 @@ static void update_pipe(Pipe3D* pipe) {
     if (fabs(newPos.x) > GRID_DIMENSION * GRID_SIZE / 2 ||
         fabs(newPos.y) > GRID_DIMENSION * GRID_SIZE / 2 ||
         fabs(newPos.z) > GRID_DIMENSION * GRID_SIZE / 2) {
-        pipe->active = 0;
-        system3d->active_pipes--;
+        finish_pipe(pipe, EVENT_DIE_STORED);
         return;
     }
     
+    record_pipe(DRAW_EVENT_SEGMENT, direction_index(pipe->direction), pipe);
     pipe->pos = newPos;
     pipe->length++;
     
     // Mark grid position
-    int gx = (int)((newPos.x + GRID_DIMENSION * GRID_SIZE / 2) / GRID_SIZE);
-    int gy = (int)((newPos.y + GRID_DIMENSION * GRID_SIZE / 2) / GRID_SIZE);
-    int gz = (int)((newPos.z + GRID_DIMENSION * GRID_SIZE / 2) / GRID_SIZE);
-    
-    if (gx >= 0 && gx < GRID_DIMENSION &&
-        gy >= 0 && gy < GRID_DIMENSION &&
-        gz >= 0 && gz < GRID_DIMENSION) {
-        system3d->grid[gx][gy][gz] = true;
-    }
+    claim_position(newPos);
     
-    // Randomly change direction
-    if (rand() % 100 < turn_probability) {
+    // Change direction at random or when the cell ahead is taken or
+    // outside the grid
+    int gx, gy, gz;
+    int cell = position_cell(newPos, &gx, &gy, &gz);
+    int blocked = cell >= 0 && !(neighbor_grid_free(&system3d->grid, cell) & (1u << direction_index(pipe->direction)));
+    if (blocked || next_random() % 100 < turn_probability) {
         Vector3 newDir = get_random_direction(pipe->direction, pipe->pos);
+        if (direction_index(newDir) != direction_index(pipe->direction)) {
+            record_pipe(DRAW_EVENT_ELBOW, direction_index(newDir), pipe);
+        }
         pipe->direction = newDir;
     }
     
     // Deactivate after max length
     if (pipe->length > MAX_PIPE_LENGTH - 5) {
-        pipe->active = 0;
-        system3d->active_pipes--;
+        finish_pipe(pipe, 0);
     }
 }
 
@@ -324,31 +771,69 @@ static void draw_pipe(Pipe3D* pipe) {
     }
 }
 
-EMSCRIPTEN_KEEPALIVE
-void pipes3d_frame() {
-    if (!system3d) return;
+// BeginMode3D derives the aspect ratio from the whole render texture, which is
+// wrong when only part of it is used
+static void set_projection(float aspect) {
+    double top = RL_CULL_DISTANCE_NEAR * tan(system3d->camera.fovy * 0.5 * DEG2RAD);
+    double right = top * aspect;
     
-    // Update existing pipes
-    for (int i = 0; i < MAX_PIPES; i++) {
-        update_pipe(&system3d->pipes[i]);
-    }
+    rlMatrixMode(RL_PROJECTION);
+    rlLoadIdentity();
+    rlFrustum(-right, right, -top, top, RL_CULL_DISTANCE_NEAR, RL_CULL_DISTANCE_FAR);
+    rlMatrixMode(RL_MODELVIEW);
+}
+
+// Adjust render scale from the smoothed frame time. Drops quickly when frames
+// run over budget and climbs back slowly while they keep up.
+static void update_auto_render_scale() {
+    float budget = 1.0f / auto_scale_target_fps;
+    system3d->frameTimeAvg = system3d->frameTimeAvg * 0.9f + GetFrameTime() * 0.1f;
     
-    // Spawn new pipes
-    if (system3d->active_pipes < max_active_pipes && rand() % 100 < spawn_rate) {
-        spawn_pipe();
+    system3d->scaleCooldown++;
+    if (system3d->frameTimeAvg > budget * 1.2f &&
+        system3d->scaleCooldown >= RENDER_SCALE_COOLDOWN) {
+        render_scale = fmaxf(MIN_RENDER_SCALE, render_scale - RENDER_SCALE_STEP);
+        system3d->scaleCooldown = 0;
+    } else if (system3d->frameTimeAvg < budget * 1.05f &&
+               system3d->scaleCooldown >= RENDER_SCALE_COOLDOWN * 4) {
+        render_scale = fminf(1.0f, render_scale + RENDER_SCALE_STEP);
+        system3d->scaleCooldown = 0;
     }
+}
+
+static void drain_commands();
+
+static void update_pipes() {
+    TRACE_SCOPE("update");
     
-    // Auto-rotate camera at controlled speed
-    system3d->rotation += camera_rotation_speed;
-    float radius = 40.0f;
-    system3d->camera.position.x = sinf(system3d->rotation) * radius;
-    system3d->camera.position.z = cosf(system3d->rotation) * radius;
+    for (int step = 0; step < steps_per_frame; step++) {
+        if (step_changes_scene()) system3d->sceneChanged = 1;
+        
+        // Update existing pipes
+        for (int i = 0; i < MAX_PIPES; i++) {
+            update_pipe(&system3d->pipes[i]);
+        }
+        if (record_events) draw_events_put(&events, DRAW_EVENT_STEP, 0, 0, NULL);
+        system3d->fadeClock += fade_speed / 255.0;
+        
+        // Spawn new pipes
+        if (system3d->active_pipes < max_active_pipes && next_random() % 100 < spawn_rate) {
+            spawn_pipe();
+        }
+    }
+}
+
+// Render the scene into the bottom-left corner of the offscreen target
+static void draw_scene(int renderWidth, int renderHeight) {
+    TRACE_SCOPE("draw");
     
-    // Render directly to window
-    BeginDrawing();
+    BeginTextureMode(system3d->target);
+        rlViewport(0, 0, renderWidth, renderHeight);
         ClearBackground(BLACK);
         
         BeginMode3D(system3d->camera);
+            set_projection((float)renderWidth / renderHeight);
+            
             // Draw grid bounds (optional)
             DrawCubeWires((Vector3){0, 0, 0}, 
                          GRID_DIMENSION * GRID_SIZE,
@@ -360,36 +845,272 @@ void pipes3d_frame() {
             for (int i = 0; i < MAX_PIPES; i++) {
                 draw_pipe(&system3d->pipes[i]);
             }
+            draw_retained();
         EndMode3D();
-        
+    EndTextureMode();
+}
+
+// Move the camera, render and present
+static void present_frame() {
+    // Auto-rotate camera at controlled speed
+    system3d->rotation += camera_rotation_speed;
+    float radius = 40.0f;
+    system3d->camera.position.x = sinf(system3d->rotation) * radius;
+    system3d->camera.position.z = cosf(system3d->rotation) * radius;
+    
+    if (auto_scale_target_fps > 0) {
+        update_auto_render_scale();
+    }
+    
+    int screenWidth = GetScreenWidth();
+    int screenHeight = GetScreenHeight();
+    int renderWidth = (int)(screenWidth * render_scale);
+    int renderHeight = (int)(screenHeight * render_scale);
+    if (renderWidth < 1) renderWidth = 1;
+    if (renderHeight < 1) renderHeight = 1;
+    ensure_render_target(renderWidth, renderHeight);
+    
+    // A still camera over pipes that neither grow nor age shows the last
+    // render again
+    Vector3 camera = system3d->camera.position;
+    int changed = system3d->sceneChanged ||
+                  renderWidth != system3d->frameWidth || renderHeight != system3d->frameHeight ||
+                  camera.x != system3d->renderedCamera.x || camera.y != system3d->renderedCamera.y ||
+                  camera.z != system3d->renderedCamera.z;
+    system3d->frameWidth = renderWidth;
+    system3d->frameHeight = renderHeight;
+    if (changed) {
+        draw_scene(renderWidth, renderHeight);
+        system3d->renderedCamera = camera;
+        system3d->sceneChanged = 0;
+    }
+    system3d->frameState = (changed ? 0 : FRAME_UNCHANGED) |
+                           (system3d->active_pipes == 0 && system3d->retainedCount == 0 ? FRAME_EMPTY : 0);
+    
+    // Upscale to the window (negative height flips the render texture)
+    TRACE_SCOPE("present");
+    BeginDrawing();
+        ClearBackground(BLACK);
+        DrawTexturePro(system3d->target.texture,
+                       (Rectangle){ 0, 0, renderWidth, -renderHeight },
+                       (Rectangle){ 0, 0, screenWidth, screenHeight },
+                       (Vector2){ 0, 0 }, 0.0f, WHITE);
     EndDrawing();
 }
 
+EMSCRIPTEN_KEEPALIVE
+void pipes3d_frame() {
+    if (!system3d) return;
+    TRACE_SCOPE("frame");
+    
+    drain_commands();
+    update_pipes();
+    release_faded();
+    if (record_events) {
+        unsigned int fade = 0;
+        draw_events_put(&events, DRAW_EVENT_FRAME, 0, 1, &fade);
+    }
+    present_frame();
+}
+
+static void replay_event(const DrawEvent* event) {
+    const unsigned int* v = event->values;
+    if (event->type == DRAW_EVENT_STEP ? step_changes_scene() : event->type != DRAW_EVENT_FRAME) {
+        system3d->sceneChanged = 1;
+    }
+    switch (event->type) {
+        case DRAW_EVENT_RESET:
+            if (event->arg != DRAW_EVENTS_3D) return;
+            for (int i = 0; i < MAX_PIPES; i++) {
+                system3d->pipes[i].active = 0;
+                system3d->pipes[i].segment_count = 0;
+            }
+            system3d->active_pipes = 0;
+            clear_retained();
+            if (event->count >= 1) memcpy(&pipe_growth_speed, &v[0], sizeof(pipe_growth_speed));
+            if (event->count >= 2) fade_speed = (int)v[1];
+            return;
+        case DRAW_EVENT_PARAM:
+            if (event->arg == EVENT_PARAM_GROWTH_SPEED) memcpy(&pipe_growth_speed, &v[0], sizeof(pipe_growth_speed));
+            if (event->arg == EVENT_PARAM_FADE_SPEED) fade_speed = (int)v[0];
+            return;
+        case DRAW_EVENT_CLEAR:
+            clear_retained();
+            return;
+        case DRAW_EVENT_STEP:
+            // Pipes between segments grow as in update_pipe()
+            for (int i = 0; i < MAX_PIPES; i++) {
+                if (system3d->pipes[i].active && !stepped[i]) system3d->pipes[i].growth_progress += pipe_growth_speed;
+            }
+            memset(stepped, 0, sizeof(stepped));
+            system3d->fadeClock += fade_speed / 255.0;
+            return;
+    }
+    
+    // The rest act on one pipe
+    if (event->type < DRAW_EVENT_SPAWN || event->type > DRAW_EVENT_DIE || v[0] >= MAX_PIPES || event->arg >= 6) {
+        return;
+    }
+    Pipe3D* pipe = &system3d->pipes[v[0]];
+    switch (event->type) {
+        case DRAW_EVENT_SPAWN:
+            if (v[1] >= GRID_DIMENSION || v[2] >= GRID_DIMENSION || v[3] >= GRID_DIMENSION) return;
+            pipe->pos.x = ((int)v[1] - GRID_DIMENSION/2) * GRID_SIZE;
+            pipe->pos.y = ((int)v[2] - GRID_DIMENSION/2) * GRID_SIZE;
+            pipe->pos.z = ((int)v[3] - GRID_DIMENSION/2) * GRID_SIZE;
+            pipe->direction = directions[event->arg];
+            pipe->color = pipe_colors[v[4] % 8];
+            if (!pipe->active) system3d->active_pipes++;
+            pipe->active = 1;
+            pipe->segment_count = 0;
+            pipe->growth_progress = 0.0f;
+            break;
+        case DRAW_EVENT_SEGMENT:
+            // Same bookkeeping as a completed segment in update_pipe()
+            if (pipe->segment_count < MAX_PIPE_LENGTH) {
+                pipe->segments[pipe->segment_count++] = pipe->pos;
+            }
+            pipe->direction = directions[event->arg];
+            pipe->pos = Vector3Add(pipe->pos, Vector3Scale(pipe->direction, SEGMENT_LENGTH));
+            pipe->growth_progress = 0.0f;
+            stepped[v[0]] = 1;
+            break;
+        case DRAW_EVENT_ELBOW:
+            pipe->direction = directions[event->arg];
+            break;
+        case DRAW_EVENT_DIE:
+            if (event->arg == EVENT_DIE_STORED && pipe->segment_count < MAX_PIPE_LENGTH) {
+                pipe->segments[pipe->segment_count++] = pipe->pos;
+            }
+            if (pipe->active) {
+                retain_pipe(pipe);
+                system3d->active_pipes--;
+            }
+            pipe->active = 0;
+            break;
+    }
+}
+
+// Draw the next frame of a stream recorded with pipes3d_setEventRecording()
+// instead of simulating. Returns the bytes used, 0 while the next frame is
+// incomplete, in which case the last one is drawn again; the caller keeps
+// the rest. The camera is this display's own, so each display can show the
+// same pipes from its own angle and speed.
+EMSCRIPTEN_KEEPALIVE
+int pipes3d_replayFrame(const unsigned char* data, int size) {
+    if (!system3d) return 0;
+    TRACE_SCOPE("frame");
+    
+    drain_commands();
+    DrawEvent event;
+    size_t end = draw_events_frame_size(data, size > 0 ? size : 0, &event);
+    for (size_t pos = 0; pos < end;) {
+        size_t start = pos;
+        if (draw_events_next(data, end, &pos, &event) < 0) {
+            pos = start + 1;
+            continue;
+        }
+        replay_event(&event);
+    }
+    release_faded();
+    present_frame();
+    return (int)end;
+}
+
+// Log what every step draws for pipes3d_replayFrame() elsewhere. Starting
+// records the current scene first; stopping drops the log.
+EMSCRIPTEN_KEEPALIVE
+void pipes3d_setEventRecording(int enabled) {
+    int was_recording = record_events;
+    record_events = enabled != 0;
+    if (!enabled) {
+        draw_events_free(&events);
+    } else if (!was_recording) {
+        record_scene();
+    }
+}
+
+EMSCRIPTEN_KEEPALIVE
+unsigned char* pipes3d_getEvents() {
+    return events.data;
+}
+
+EMSCRIPTEN_KEEPALIVE
+int pipes3d_getEventSize() {
+    return (int)events.size;
+}
+
+// Once the caller has sent the events on
+EMSCRIPTEN_KEEPALIVE
+void pipes3d_clearEvents() {
+    draw_events_clear(&events);
+}
+
+// FRAME_* flags of the last pipes3d_frame() or pipes3d_replayFrame(), so
+// the caller can slow down while nothing happens. Spawns are rolled once per
+// frame, so a caller that ticks slower still runs every frame it skipped.
+EMSCRIPTEN_KEEPALIVE
+int pipes3d_getFrameState() {
+    return system3d ? system3d->frameState : 0;
+}
+
 EMSCRIPTEN_KEEPALIVE
 void pipes3d_resize(int width, int height) {
     if (!system3d) return;
     
     SetWindowSize(width, height);
     
-    // Recreate render texture with new size
-    UnloadRenderTexture(system3d->target);
-    system3d->target = LoadRenderTexture(width, height);
+    // Only reallocates when the window outgrows the current texture
+    ensure_render_target((int)(width * render_scale), (int)(height * render_scale));
 }
 
 EMSCRIPTEN_KEEPALIVE
 void pipes3d_cleanup() {
     if (system3d) {
         UnloadRenderTexture(system3d->target);
+        for (int i = 0; i < RETAINED_CHUNKS; i++) {
+            if (system3d->retained[i].mesh.vboId) UnloadMesh(system3d->retained[i].mesh);
+        }
+        if (system3d->aging.maps) UnloadMaterial(system3d->aging);
         CloseWindow();
+        free_cells_destroy(&system3d->free_cells);
         free(system3d);
         system3d = NULL;
     }
+    draw_events_free(&events);
+}
+
+// Copy the last frame as top-down RGBA rows, for offline export. Returns 0
+// unless width x height is the size it was rendered at.
+EMSCRIPTEN_KEEPALIVE
+int pipes3d_readFrame(unsigned char* rgba, int width, int height) {
+    if (!system3d || width != system3d->frameWidth || height != system3d->frameHeight) return 0;
+    
+    unsigned char* pixels = rlReadTexturePixels(system3d->target.texture.id,
+                                                system3d->targetWidth, system3d->targetHeight,
+                                                system3d->target.texture.format);
+    if (!pixels) return 0;
+    
+    // Texture rows run bottom-up and the frame sits in the bottom-left corner
+    for (int y = 0; y < height; y++) {
+        memcpy(rgba + (size_t)y * width * 4,
+               pixels + (size_t)(height - 1 - y) * system3d->targetWidth * 4,
+               (size_t)width * 4);
+    }
+    MemFree(pixels);
+    return 1;
 }
 
 // Parameter setters
+// Finished pipes fade by speed / 255 per channel and step, as the 2D
+// engines fade their pixels per frame; 0 keeps them until the grid recycles
 EMSCRIPTEN_KEEPALIVE
 void pipes3d_setFadeSpeed(int speed) {
-    fade_speed = speed;
+    fade_speed = speed > 0 ? speed : 0;
+    if (record_events) {
+        unsigned int value = (unsigned int)fade_speed;
+        draw_events_put(&events, DRAW_EVENT_PARAM, EVENT_PARAM_FADE_SPEED, 1, &value);
+    }
 }
 
 EMSCRIPTEN_KEEPALIVE
@@ -409,6 +1130,27 @@ void pipes3d_setMaxPipes(int max) {
     }
 }
 
+EMSCRIPTEN_KEEPALIVE
+void pipes3d_setStepsPerFrame(int steps) {
+    if (steps < 1) steps = 1;
+    if (steps > MAX_STEPS_PER_FRAME) steps = MAX_STEPS_PER_FRAME;
+    steps_per_frame = steps;
+}
+
+EMSCRIPTEN_KEEPALIVE
+void pipes3d_setRenderScale(float scale) {
+    render_scale = fmaxf(MIN_RENDER_SCALE, fminf(1.0f, scale));
+}
+
+EMSCRIPTEN_KEEPALIVE
+void pipes3d_setAutoRenderScale(int targetFps) {
+    auto_scale_target_fps = targetFps > 0 ? targetFps : 0;
+    if (system3d) {
+        system3d->frameTimeAvg = targetFps > 0 ? 1.0f / targetFps : 0;
+        system3d->scaleCooldown = 0;
+    }
+}
+
 EMSCRIPTEN_KEEPALIVE
 void pipes3d_setCameraSpeed(float speed) {
     camera_rotation_speed = speed * 0.001f; // Scale down for reasonable rotation
@@ -417,6 +1159,10 @@ void pipes3d_setCameraSpeed(float speed) {
 EMSCRIPTEN_KEEPALIVE
 void pipes3d_setPipeSpeed(int speed) {
     pipe_growth_speed = speed * 0.001f; // Scale to reasonable growth rate
+    if (record_events) {
+        unsigned int bits = growth_speed_bits();
+        draw_events_put(&events, DRAW_EVENT_PARAM, EVENT_PARAM_GROWTH_SPEED, 1, &bits);
+    }
 }
 
 EMSCRIPTEN_KEEPALIVE
@@ -464,4 +1210,206 @@ void pipes3d_mouseMove(int x, int y) {
     system3d->camera.position.y = radius * sinf(verticalAngle);
     
     system3d->lastMousePos = currentPos;
-}
\ No newline at end of file
+}
+
+// Command ring
+EMSCRIPTEN_KEEPALIVE
+CommandRing* pipes3d_getCommandRing() {
+    if (command_ring.capacity == 0) {
+        command_ring_init(&command_ring);
+    }
+    return &command_ring;
+}
+
+// Apply input and parameter changes queued by JS since the last frame.
+// Consecutive mouse moves collapse into the last one, which is equivalent
+// because pipes3d_mouseMove works from absolute positions.
+static void drain_commands() {
+    Command cmd;
+    int moved = 0;
+    int moveX = 0, moveY = 0;
+    
+    while (command_ring_pop(&command_ring, &cmd)) {
+        if (cmd.type == CMD_MOUSE_MOVE) {
+            moved = 1;
+            moveX = cmd.a;
+            moveY = cmd.b;
+            continue;
+        }
+        
+        // Keep moves ordered relative to button changes
+        if (moved && (cmd.type == CMD_MOUSE_DOWN || cmd.type == CMD_MOUSE_UP)) {
+            pipes3d_mouseMove(moveX, moveY);
+            moved = 0;
+        }
+        
+        switch (cmd.type) {
+            case CMD_MOUSE_DOWN: pipes3d_mouseDown(cmd.a, cmd.b); break;
+            case CMD_MOUSE_UP: pipes3d_mouseUp(); break;
+            case CMD_SET_FADE_SPEED: pipes3d_setFadeSpeed(cmd.a); break;
+            case CMD_SET_SPAWN_RATE: pipes3d_setSpawnRate(cmd.a); break;
+            case CMD_SET_TURN_PROBABILITY: pipes3d_setTurnProbability(cmd.a); break;
+            case CMD_SET_MAX_PIPES: pipes3d_setMaxPipes(cmd.a); break;
+            case CMD_SET_CAMERA_SPEED: pipes3d_setCameraSpeed(cmd.f); break;
+            case CMD_SET_PIPE_SPEED: pipes3d_setPipeSpeed(cmd.a); break;
+            case CMD_SET_SEGMENT_DELAY: pipes3d_setSegmentDelay(cmd.a); break;
+            case CMD_SET_RENDER_SCALE: pipes3d_setRenderScale(cmd.f); break;
+            case CMD_SET_AUTO_RENDER_SCALE: pipes3d_setAutoRenderScale(cmd.a); break;
+            case CMD_SET_STEPS_PER_FRAME: pipes3d_setStepsPerFrame(cmd.a); break;
+            default: break;
+        }
+    }
+    
+    if (moved) {
+        pipes3d_mouseMove(moveX, moveY);
+    }
+}
+
+#define SNAPSHOT_MAGIC 0x33504950 // "PIP3"
+#define SNAPSHOT_VERSION 1
+
+static int color_index(Color color) {
+    for (int i = 0; i < 8; i++) {
+        if (color.r == pipe_colors[i].r && color.g == pipe_colors[i].g && color.b == pipe_colors[i].b) return i;
+    }
+    return 0;
+}
+
+// Pipe positions are whole world units well inside +-127
+static void put_position(SnapshotWriter* w, Vector3 pos) {
+    snapshot_put_u8(w, (uint8_t)(int8_t)roundf(pos.x));
+    snapshot_put_u8(w, (uint8_t)(int8_t)roundf(pos.y));
+    snapshot_put_u8(w, (uint8_t)(int8_t)roundf(pos.z));
+}
+
+static Vector3 get_position(SnapshotReader* r) {
+    Vector3 pos;
+    pos.x = (int8_t)snapshot_get_u8(r);
+    pos.y = (int8_t)snapshot_get_u8(r);
+    pos.z = (int8_t)snapshot_get_u8(r);
+    return pos;
+}
+
+// Snapshot layout, little-endian:
+//   u32 magic, u16 version, u16 reserved, u32 random state
+//   f32 camera rotation, f32 x3 camera position
+//   u8 pipe count, then per active pipe: i8 x3 position, u8 direction,
+//   u8 color, u8 length, u8 segment count, u16 update counter,
+//   f32 growth progress, i8 x3 per segment
+//   grid occupancy, one bit per cell in cell_index() order
+EMSCRIPTEN_KEEPALIVE
+unsigned int pipes3d_snapshotMaxSize() {
+    return 33 + MAX_PIPES * (13 + MAX_PIPE_LENGTH * 3) + snapshot_bits_size(GRID_CELLS);
+}
+
+// Returns the bytes written, 0 if not running or data is too small
+EMSCRIPTEN_KEEPALIVE
+unsigned int pipes3d_snapshot(unsigned char* data, unsigned int size) {
+    if (!system3d) return 0;
+    
+    SnapshotWriter w = snapshot_writer(data, size);
+    snapshot_put_u32(&w, SNAPSHOT_MAGIC);
+    snapshot_put_u16(&w, SNAPSHOT_VERSION);
+    snapshot_put_u16(&w, 0);
+    snapshot_put_u32(&w, random_state);
+    snapshot_put_f32(&w, system3d->rotation);
+    snapshot_put_f32(&w, system3d->camera.position.x);
+    snapshot_put_f32(&w, system3d->camera.position.y);
+    snapshot_put_f32(&w, system3d->camera.position.z);
+    
+    snapshot_put_u8(&w, system3d->active_pipes);
+    for (int i = 0; i < MAX_PIPES; i++) {
+        const Pipe3D* pipe = &system3d->pipes[i];
+        if (!pipe->active) continue;
+        put_position(&w, pipe->pos);
+        snapshot_put_u8(&w, direction_index(pipe->direction));
+        snapshot_put_u8(&w, color_index(pipe->color));
+        snapshot_put_u8(&w, pipe->length);
+        snapshot_put_u8(&w, pipe->segment_count);
+        snapshot_put_u16(&w, pipe->update_counter);
+        snapshot_put_f32(&w, pipe->growth_progress);
+        for (int s = 0; s < pipe->segment_count; s++) {
+            put_position(&w, pipe->segments[s]);
+        }
+    }
+    
+    snapshot_put_bits(&w, system3d->cells, GRID_CELLS, NEIGHBOR_OCCUPIED);
+    return w.ok ? (unsigned int)w.pos : 0;
+}
+
+// Returns 0 if the snapshot is damaged, in which case the scene restarts empty
+EMSCRIPTEN_KEEPALIVE
+int pipes3d_restore(const unsigned char* data, unsigned int size) {
+    if (!system3d) return 0;
+    
+    SnapshotReader r = snapshot_reader(data, size);
+    int valid = snapshot_get_u32(&r) == SNAPSHOT_MAGIC &&
+                snapshot_get_u16(&r) == SNAPSHOT_VERSION;
+    snapshot_get_u16(&r);
+    unsigned int state = snapshot_get_u32(&r);
+    float rotation = snapshot_get_f32(&r);
+    Vector3 camera;
+    camera.x = snapshot_get_f32(&r);
+    camera.y = snapshot_get_f32(&r);
+    camera.z = snapshot_get_f32(&r);
+    int count = snapshot_get_u8(&r);
+    if (!valid || !r.ok || state == 0 || count > MAX_PIPES ||
+        !isfinite(rotation) || !isfinite(camera.x) || !isfinite(camera.y) || !isfinite(camera.z)) {
+        return 0;
+    }
+    
+    for (int i = 0; i < MAX_PIPES; i++) {
+        system3d->pipes[i].active = 0;
+        system3d->pipes[i].segment_count = 0;
+    }
+    clear_retained(); // Not part of snapshots
+    for (int i = 0; i < count && r.ok; i++) {
+        Pipe3D* pipe = &system3d->pipes[i];
+        pipe->pos = get_position(&r);
+        int dir = snapshot_get_u8(&r);
+        int color = snapshot_get_u8(&r);
+        pipe->length = snapshot_get_u8(&r);
+        pipe->segment_count = snapshot_get_u8(&r);
+        pipe->update_counter = snapshot_get_u16(&r);
+        pipe->growth_progress = snapshot_get_f32(&r);
+        if (dir >= 6 || color >= 8 || pipe->length > MAX_PIPE_LENGTH ||
+            pipe->segment_count > MAX_PIPE_LENGTH || !isfinite(pipe->growth_progress)) {
+            r.ok = 0;
+            break;
+        }
+        pipe->direction = directions[dir];
+        pipe->color = pipe_colors[color];
+        for (int s = 0; s < pipe->segment_count; s++) {
+            pipe->segments[s] = get_position(&r);
+        }
+        pipe->active = 1;
+    }
+    
+    snapshot_get_bits(&r, system3d->cells, GRID_CELLS);
+    
+    if (!r.ok) {
+        clear_grid();
+        for (int i = 0; i < MAX_PIPES; i++) {
+            system3d->pipes[i].active = 0;
+            system3d->pipes[i].segment_count = 0;
+        }
+        system3d->active_pipes = 0;
+        record_scene();
+        return 0;
+    }
+    
+    // Neighbor masks and the free-cell index are derived from the grid
+    // rather than stored
+    neighbor_grid_rebuild(&system3d->grid);
+    free_cells_reset(&system3d->free_cells);
+    for (int cell = 0; cell < GRID_CELLS; cell++) {
+        if (neighbor_grid_occupied(&system3d->grid, cell)) free_cells_claim(&system3d->free_cells, cell);
+    }
+    
+    system3d->active_pipes = count;
+    system3d->rotation = rotation;
+    system3d->camera.position = camera;
+    random_state = state;
+    record_scene();
+    return 1;
+}
@@ -0,0 +1,179 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Little-endian writer and reader for the engines' scene snapshots. Both are
+// bounds checked: running out of room or past the end of the data clears ok
+// and turns further calls into no-ops, so callers check once at the end.
+
+typedef struct {
+    unsigned char* data;
+    size_t size;
+    size_t pos;
+    int ok;
+} SnapshotWriter;
+
+typedef struct {
+    const unsigned char* data;
+    size_t size;
+    size_t pos;
+    int ok;
+} SnapshotReader;
+
+static inline SnapshotWriter snapshot_writer(void* data, size_t size) {
+    SnapshotWriter w = { (unsigned char*)data, size, 0, data != NULL };
+    return w;
+}
+
+static inline SnapshotReader snapshot_reader(const void* data, size_t size) {
+    SnapshotReader r = { (const unsigned char*)data, size, 0, data != NULL };
+    return r;
+}
+
+// Reserve n bytes of output, or NULL once the buffer is full
+static inline unsigned char* snapshot_reserve(SnapshotWriter* w, size_t n) {
+    if (!w->ok || n > w->size - w->pos) {
+        w->ok = 0;
+        return NULL;
+    }
+    unsigned char* p = w->data + w->pos;
+    w->pos += n;
+    return p;
+}
+
+// Consume n bytes of input, or NULL once the data runs out
+static inline const unsigned char* snapshot_take(SnapshotReader* r, size_t n) {
+    if (!r->ok || n > r->size - r->pos) {
+        r->ok = 0;
+        return NULL;
+    }
+    const unsigned char* p = r->data + r->pos;
+    r->pos += n;
+    return p;
+}
+
+static inline void snapshot_put_u8(SnapshotWriter* w, uint32_t v) {
+    unsigned char* p = snapshot_reserve(w, 1);
+    if (p) p[0] = (unsigned char)v;
+}
+
+static inline void snapshot_put_u16(SnapshotWriter* w, uint32_t v) {
+    unsigned char* p = snapshot_reserve(w, 2);
+    if (p) {
+        p[0] = (unsigned char)v;
+        p[1] = (unsigned char)(v >> 8);
+    }
+}
+
+static inline void snapshot_put_u32(SnapshotWriter* w, uint32_t v) {
+    unsigned char* p = snapshot_reserve(w, 4);
+    if (p) {
+        p[0] = (unsigned char)v;
+        p[1] = (unsigned char)(v >> 8);
+        p[2] = (unsigned char)(v >> 16);
+        p[3] = (unsigned char)(v >> 24);
+    }
+}
+
+static inline void snapshot_put_f32(SnapshotWriter* w, float v) {
+    uint32_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    snapshot_put_u32(w, bits);
+}
+
+static inline uint32_t snapshot_get_u8(SnapshotReader* r) {
+    const unsigned char* p = snapshot_take(r, 1);
+    return p ? p[0] : 0;
+}
+
+static inline uint32_t snapshot_get_u16(SnapshotReader* r) {
+    const unsigned char* p = snapshot_take(r, 2);
+    return p ? (uint32_t)p[0] | (uint32_t)p[1] << 8 : 0;
+}
+
+static inline uint32_t snapshot_get_u32(SnapshotReader* r) {
+    const unsigned char* p = snapshot_take(r, 4);
+    return p ? (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24 : 0;
+}
+
+static inline float snapshot_get_f32(SnapshotReader* r) {
+    uint32_t bits = snapshot_get_u32(r);
+    float v;
+    memcpy(&v, &bits, sizeof(v));
+    return v;
+}
+
+// Occupancy grids, one bit per cell. Cells are written as occupied when
+// they have any bit of mask set and read back as 0 or 1.
+static inline size_t snapshot_bits_size(int count) {
+    return ((size_t)count + 7) / 8;
+}
+
+static inline void snapshot_put_bits(SnapshotWriter* w, const unsigned char* cells, int count, unsigned int mask) {
+    unsigned char* p = snapshot_reserve(w, snapshot_bits_size(count));
+    if (!p) return;
+    memset(p, 0, snapshot_bits_size(count));
+    for (int i = 0; i < count; i++) {
+        if (cells[i] & mask) p[i >> 3] |= (unsigned char)(1 << (i & 7));
+    }
+}
+
+static inline void snapshot_get_bits(SnapshotReader* r, unsigned char* cells, int count) {
+    const unsigned char* p = snapshot_take(r, snapshot_bits_size(count));
+    if (!p) return;
+    for (int i = 0; i < count; i++) {
+        cells[i] = (p[i >> 3] >> (i & 7)) & 1;
+    }
+}
+
+// RGBA framebuffers as runs of up to 255 equal pixels, 4 bytes per run
+// (length, r, g, b). Alpha is not stored and restores as opaque. Faded
+// backgrounds collapse into long runs; the worst case is the raw size.
+static inline size_t snapshot_rle_max_size(int pixels) {
+    return (size_t)pixels * 4;
+}
+
+static inline void snapshot_put_rle_rgb(SnapshotWriter* w, const unsigned char* rgba, int pixels) {
+    int i = 0;
+    while (i < pixels) {
+        const unsigned char* px = rgba + (size_t)i * 4;
+        int run = 1;
+        while (run < 255 && i + run < pixels) {
+            const unsigned char* next = px + (size_t)run * 4;
+            if (next[0] != px[0] || next[1] != px[1] || next[2] != px[2]) break;
+            run++;
+        }
+        unsigned char* p = snapshot_reserve(w, 4);
+        if (!p) return;
+        p[0] = (unsigned char)run;
+        p[1] = px[0];
+        p[2] = px[1];
+        p[3] = px[2];
+        i += run;
+    }
+}
+
+static inline void snapshot_get_rle_rgb(SnapshotReader* r, unsigned char* rgba, int pixels) {
+    int i = 0;
+    while (i < pixels) {
+        const unsigned char* p = snapshot_take(r, 4);
+        if (!p) return;
+        int run = p[0];
+        if (run == 0 || run > pixels - i) {
+            r->ok = 0;
+            return;
+        }
+        for (int end = i + run; i < end; i++) {
+            unsigned char* px = rgba + (size_t)i * 4;
+            px[0] = p[1];
+            px[1] = p[2];
+            px[2] = p[3];
+            px[3] = 255;
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,223 @@
+// Recorder behind the TRACE_* markers of src/trace.h, only built into
+// native programs compiled with PIPES_TRACE.
+//
+// Each thread appends to its own fixed-size buffer, so recording takes no
+// locks: the buffer is allocated on the thread's first event and pushed onto
+// a global list with a compare-and-swap, and the event count is published
+// with a release store so trace_write() can run while threads still record.
+// Events past a buffer's capacity are dropped and counted.
+//
+// Hardware counters work the same way: each thread opens its own counter
+// group on its first counted scope and keeps its totals in a table of its
+// own, which trace_counters_get() merges.
+
+#ifdef PIPES_TRACE
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "perf_counters.h"
+#include "trace.h"
+
+#define TRACE_BUFFER_EVENTS (1 << 20) // 24 MB per thread, touched as it fills
+#define TRACE_PHASES 64 // Scope names counted per thread, later ones are not
+
+_Static_assert(TRACE_COUNTERS == PERF_COUNTERS, "TraceScope must hold every counter");
+
+typedef struct {
+    const char* name;
+    uint64_t start;
+    uint64_t end;
+} TraceEvent;
+
+typedef struct TraceBuffer {
+    struct TraceBuffer* next;
+    int tid;
+    atomic_uint count;
+    atomic_uint dropped;
+    TraceEvent events[];
+} TraceBuffer;
+
+static _Atomic(TraceBuffer*) buffers;
+static atomic_int next_tid = 1;
+static _Thread_local TraceBuffer* local_buffer;
+static _Thread_local int local_failed;
+
+typedef struct CounterTable {
+    struct CounterTable* next;
+    PerfCounters perf;
+    int phase_count;
+    TracePhase phases[TRACE_PHASES];
+} CounterTable;
+
+int trace_counting;
+static _Atomic(CounterTable*) counter_tables;
+static _Thread_local CounterTable* local_table;
+static _Thread_local int local_counters_failed;
+
+uint64_t trace_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static TraceBuffer* create_buffer(void) {
+    TraceBuffer* buffer = (TraceBuffer*)malloc(sizeof(TraceBuffer) + TRACE_BUFFER_EVENTS * sizeof(TraceEvent));
+    if (!buffer) {
+        local_failed = 1;
+        return NULL;
+    }
+    buffer->tid = atomic_fetch_add(&next_tid, 1);
+    atomic_init(&buffer->count, 0);
+    atomic_init(&buffer->dropped, 0);
+
+    TraceBuffer* head = atomic_load_explicit(&buffers, memory_order_relaxed);
+    do {
+        buffer->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(&buffers, &head, buffer,
+                                                    memory_order_release, memory_order_relaxed));
+    return buffer;
+}
+
+void trace_record(const char* name, uint64_t start, uint64_t end) {
+    TraceBuffer* buffer = local_buffer;
+    if (!buffer) {
+        if (local_failed) return;
+        buffer = local_buffer = create_buffer();
+        if (!buffer) return;
+    }
+
+    // Only this thread writes count, the release store publishes the event
+    unsigned int count = atomic_load_explicit(&buffer->count, memory_order_relaxed);
+    if (count >= TRACE_BUFFER_EVENTS) {
+        atomic_fetch_add_explicit(&buffer->dropped, 1, memory_order_relaxed);
+        return;
+    }
+    buffer->events[count] = (TraceEvent){ name, start, end };
+    atomic_store_explicit(&buffer->count, count + 1, memory_order_release);
+}
+
+static CounterTable* counter_table(void) {
+    if (local_table || local_counters_failed) return local_table;
+    CounterTable* table = (CounterTable*)calloc(1, sizeof(CounterTable));
+    if (!table || !perf_counters_open(&table->perf)) {
+        free(table);
+        local_counters_failed = 1;
+        return NULL;
+    }
+
+    CounterTable* head = atomic_load_explicit(&counter_tables, memory_order_relaxed);
+    do {
+        table->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(&counter_tables, &head, table,
+                                                    memory_order_release, memory_order_relaxed));
+    return local_table = table;
+}
+
+int trace_counters_enable(int enabled) {
+    CounterTable* table = enabled ? counter_table() : NULL;
+    __atomic_store_n(&trace_counting, table != NULL, __ATOMIC_RELAXED);
+    return table ? table->perf.count : 0;
+}
+
+void trace_counters_start(TraceScope* scope) {
+    CounterTable* table = counter_table();
+    PerfSample sample;
+    if (!table || !perf_counters_read(&table->perf, &sample)) return;
+    memcpy(scope->counters, sample.values, sizeof(scope->counters));
+    scope->counted = 1;
+}
+
+void trace_counters_stop(TraceScope* scope, uint64_t end) {
+    CounterTable* table = local_table;
+    PerfSample sample;
+    if (!perf_counters_read(&table->perf, &sample)) return;
+
+    // Names are literals, so the same scope always has the same pointer
+    TracePhase* phase = NULL;
+    for (int i = 0; i < table->phase_count && !phase; i++) {
+        if (table->phases[i].name == scope->name) phase = &table->phases[i];
+    }
+    if (!phase) {
+        if (table->phase_count == TRACE_PHASES) return;
+        phase = &table->phases[table->phase_count++];
+        phase->name = scope->name;
+    }
+    phase->calls++;
+    phase->ns += end - scope->start;
+    for (int i = 0; i < TRACE_COUNTERS; i++) {
+        if (sample.values[i] > scope->counters[i]) phase->counters[i] += sample.values[i] - scope->counters[i];
+    }
+}
+
+int trace_counters_get(TracePhase* phases, int max) {
+    int count = 0;
+    for (CounterTable* t = atomic_load_explicit(&counter_tables, memory_order_acquire); t; t = t->next) {
+        for (int i = 0; i < t->phase_count; i++) {
+            const TracePhase* phase = &t->phases[i];
+            int j = 0;
+            while (j < count && strcmp(phases[j].name, phase->name) != 0) j++;
+            if (j == count) {
+                if (count == max) continue;
+                phases[count++] = (TracePhase){ phase->name };
+            }
+            phases[j].calls += phase->calls;
+            phases[j].ns += phase->ns;
+            for (int c = 0; c < TRACE_COUNTERS; c++) {
+                phases[j].counters[c] += phase->counters[c];
+            }
+        }
+    }
+    return count;
+}
+
+void trace_counters_reset(void) {
+    for (CounterTable* t = atomic_load_explicit(&counter_tables, memory_order_acquire); t; t = t->next) {
+        t->phase_count = 0;
+        memset(t->phases, 0, sizeof(t->phases));
+    }
+}
+
+// Timestamps in the file are microseconds from the earliest event
+int trace_write(const char* path) {
+    FILE* out = fopen(path, "w");
+    if (!out) return 0;
+
+    TraceBuffer* head = atomic_load_explicit(&buffers, memory_order_acquire);
+    uint64_t epoch = UINT64_MAX;
+    for (TraceBuffer* b = head; b; b = b->next) {
+        unsigned int count = atomic_load_explicit(&b->count, memory_order_acquire);
+        for (unsigned int i = 0; i < count; i++) {
+            if (b->events[i].start < epoch) epoch = b->events[i].start;
+        }
+    }
+
+    fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", out);
+    int first = 1;
+    for (TraceBuffer* b = head; b; b = b->next) {
+        unsigned int count = atomic_load_explicit(&b->count, memory_order_acquire);
+        fprintf(out, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%d,"
+                "\"args\":{\"name\":\"thread %d\",\"dropped_events\":%u}}",
+                first ? "" : ",\n", b->tid, b->tid, atomic_load(&b->dropped));
+        first = 0;
+        for (unsigned int i = 0; i < count; i++) {
+            const TraceEvent* e = &b->events[i];
+            double ts = (e->start - epoch) / 1000.0;
+            if (e->end == 0) {
+                fprintf(out, ",\n{\"ph\":\"i\",\"s\":\"t\",\"name\":\"%s\",\"pid\":1,\"tid\":%d,\"ts\":%.3f}",
+                        e->name, b->tid, ts);
+            } else {
+                fprintf(out, ",\n{\"ph\":\"X\",\"name\":\"%s\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                        e->name, b->tid, ts, (e->end - e->start) / 1000.0);
+            }
+        }
+    }
+    fputs("\n]}\n", out);
+
+    int ok = !ferror(out);
+    return fclose(out) == 0 && ok;
+}
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+// Scoped timeline markers for the engines' hot phases. They compile to
+// nothing unless PIPES_TRACE is defined; native builds with it record every
+// span into a per-thread buffer (src/trace.c) and trace_write() dumps them
+// as Chrome trace-event JSON for chrome://tracing or ui.perfetto.dev.
+//
+//     TRACE_SCOPE("fade");      // Span from here to the end of the block
+//     TRACE_INSTANT("grow");    // Zero-length marker
+//
+// Names must be string literals or otherwise outlive the trace.
+//
+// trace_counters_enable() adds hardware counters (src/perf_counters.h): every
+// scope then also reads its thread's counters at both ends and adds its
+// calls, time and counts to a total per name. Totals are inclusive, so a
+// scope's include those of the scopes nested in it, plus their reads.
+
+#include <stdint.h>
+
+#define TRACE_COUNTERS 5 // PERF_COUNTERS in src/perf_counters.h
+
+typedef struct {
+    const char* name;
+    uint64_t calls;
+    uint64_t ns;
+    uint64_t counters[TRACE_COUNTERS]; // Indexed by PERF_*
+} TracePhase;
+
+#ifdef PIPES_TRACE
+
+typedef struct {
+    const char* name;
+    uint64_t start;
+    int counted; // counters holds the thread's counts at start
+    uint64_t counters[TRACE_COUNTERS];
+} TraceScope;
+
+extern int trace_counting;
+
+uint64_t trace_now(void); // Nanoseconds, monotonic
+// end == 0 records an instant event at start
+void trace_record(const char* name, uint64_t start, uint64_t end);
+// Returns 0 if the file could not be written
+int trace_write(const char* path);
+
+// Returns how many counters the calling thread has, 0 if none and the
+// scopes stay uncounted
+int trace_counters_enable(int enabled);
+// Totals so far across threads, one per name. Returns how many were written.
+int trace_counters_get(TracePhase* phases, int max);
+// Call while no traced code runs
+void trace_counters_reset(void);
+void trace_counters_start(TraceScope* scope);
+void trace_counters_stop(TraceScope* scope, uint64_t end);
+
+static inline TraceScope trace_scope_begin(const char* name) {
+    TraceScope scope = { name, 0, 0, { 0 } };
+    if (__atomic_load_n(&trace_counting, __ATOMIC_RELAXED)) trace_counters_start(&scope);
+    scope.start = trace_now();
+    return scope;
+}
+
+static inline void trace_scope_end(TraceScope* scope) {
+    uint64_t end = trace_now();
+    if (scope->counted) trace_counters_stop(scope, end); // Before recording adds to the counts
+    trace_record(scope->name, scope->start, end);
+}
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) \
+    TraceScope TRACE_CONCAT(trace_scope_, __LINE__) __attribute__((cleanup(trace_scope_end))) = trace_scope_begin(name)
+#define TRACE_INSTANT(name) \
+    trace_record((name), trace_now(), 0)
+
+#else
+
+#define TRACE_SCOPE(name) ((void)0)
+#define TRACE_INSTANT(name) ((void)0)
+
+static inline int trace_write(const char* path) {
+    (void)path;
+    return 0;
+}
+
+static inline int trace_counters_enable(int enabled) {
+    (void)enabled;
+    return 0;
+}
+
+static inline int trace_counters_get(TracePhase* phases, int max) {
+    (void)phases;
+    (void)max;
+    return 0;
+}
+
+static inline void trace_counters_reset(void) {
+}
+
+#endif
+
+#endif
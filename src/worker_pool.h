@@ -0,0 +1,144 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+// A fixed set of threads that run one task at a time. worker_pool_run()
+// returns once every worker has finished the task, so consecutive runs are
+// separated by a barrier. The calling thread takes part as worker 0, so a
+// pool of one starts no threads. WebAssembly builds run everything inline
+// rather than block the browser's main thread on workers.
+
+#ifndef __EMSCRIPTEN__
+#define WORKER_POOL_THREADS 1
+#include <pthread.h>
+#endif
+
+#define WORKER_POOL_MAX 64
+
+// Called once per worker with its index in 0..workers-1
+typedef void (*WorkerTask)(void* arg, int worker, int workers);
+
+typedef struct WorkerPool WorkerPool;
+
+typedef struct {
+    WorkerPool* pool;
+    int index;
+} WorkerSlot;
+
+struct WorkerPool {
+    int workers;
+#ifdef WORKER_POOL_THREADS
+    pthread_t threads[WORKER_POOL_MAX];
+    WorkerSlot slots[WORKER_POOL_MAX];
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t done;
+    WorkerTask task;
+    void* arg;
+    unsigned int generation; // Bumped for every task
+    int pending; // Workers still running the current task
+    int stopping;
+#endif
+};
+
+#ifdef WORKER_POOL_THREADS
+static void* worker_pool_main(void* arg) {
+    WorkerSlot* slot = (WorkerSlot*)arg;
+    WorkerPool* pool = slot->pool;
+
+    // Start from the generation the pool started at, not the current one: a
+    // task may already have been posted before this thread got to run
+    unsigned int seen = 0;
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (pool->generation == seen && !pool->stopping) {
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        }
+        if (pool->stopping) break;
+        seen = pool->generation;
+        WorkerTask task = pool->task;
+        void* task_arg = pool->arg;
+        pthread_mutex_unlock(&pool->lock);
+
+        task(task_arg, slot->index, pool->workers);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->pending == 0) pthread_cond_signal(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+#endif
+
+static inline void worker_pool_stop(WorkerPool* pool) {
+#ifdef WORKER_POOL_THREADS
+    if (pool->workers > 1) {
+        pthread_mutex_lock(&pool->lock);
+        pool->stopping = 1;
+        pthread_cond_broadcast(&pool->wake);
+        pthread_mutex_unlock(&pool->lock);
+        for (int i = 1; i < pool->workers; i++) {
+            pthread_join(pool->threads[i], NULL);
+        }
+        pthread_mutex_destroy(&pool->lock);
+        pthread_cond_destroy(&pool->wake);
+        pthread_cond_destroy(&pool->done);
+    }
+#endif
+    pool->workers = 1;
+}
+
+// (Re)start with the given number of workers, caller included. Returns the
+// number actually running, 1 if threads are unavailable.
+static inline int worker_pool_start(WorkerPool* pool, int workers) {
+    worker_pool_stop(pool);
+    if (workers > WORKER_POOL_MAX) workers = WORKER_POOL_MAX;
+    if (workers <= 1) return 1;
+
+#ifdef WORKER_POOL_THREADS
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    pool->generation = 0; // Workers start out having seen generation 0
+    pool->pending = 0;
+    pool->stopping = 0;
+    pool->workers = workers;
+    for (int i = 1; i < workers; i++) {
+        pool->slots[i] = (WorkerSlot){ pool, i };
+        if (pthread_create(&pool->threads[i], NULL, worker_pool_main, &pool->slots[i]) != 0) {
+            // Stop the ones that did start and run inline
+            pool->workers = i;
+            worker_pool_stop(pool);
+            return 1;
+        }
+    }
+    return workers;
+#else
+    return 1;
+#endif
+}
+
+static inline void worker_pool_run(WorkerPool* pool, WorkerTask task, void* arg) {
+#ifdef WORKER_POOL_THREADS
+    if (pool->workers > 1) {
+        pthread_mutex_lock(&pool->lock);
+        pool->task = task;
+        pool->arg = arg;
+        pool->pending = pool->workers - 1;
+        pool->generation++;
+        pthread_cond_broadcast(&pool->wake);
+        pthread_mutex_unlock(&pool->lock);
+
+        task(arg, 0, pool->workers);
+
+        pthread_mutex_lock(&pool->lock);
+        while (pool->pending > 0) {
+            pthread_cond_wait(&pool->done, &pool->lock);
+        }
+        pthread_mutex_unlock(&pool->lock);
+        return;
+    }
+#endif
+    task(arg, 0, 1);
+}
+
+#endif